@@ -3,35 +3,237 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 #include <iostream>
+#include <iomanip>
 #include <functional>
 #include <memory>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <array>
+#include <utility>
 
 #include "Transform.hpp"
 #include "Mesh.hpp"
 #include "Parser.hpp"
+#include "Options.hpp"
+#include "InstanceSet.hpp"
+#include "SpscQueue.hpp"
+#include "TextureManager.hpp"
+#include "TransparencyPass.hpp"
+#include "DepthPrepass.hpp"
+#include "OcclusionCuller.hpp"
+#include "FrameRecording.hpp"
 
 #define WIDTH 960.0f
 #define HEIGHT 720.0f
-#define TRANSITION_SPEED 0.05f
+#define TRANSITION_SPEED 3.0f     // texture blend per second
+#define MOVE_SPEED 6.0f           // units per second while a movement key is held
+#define TEXTURE_UNIT 0
+#define INSTANCE_DATA_UNIT 2
+#define IDLE_TIMEOUT 0.25
+#define FIXED_TIMESTEP (1.0 / 120.0)
+#define MAX_FRAME_TIME 0.25       // longer frames are clamped so a stall does not replay seconds of updates
+#define INPUT_QUEUE_SIZE 1024
+#define REPLAY_WARMUP_FRAMES 5    // first replayed frames, building programs and streaming textures, left out of the statistics
 
+/* Input forwarded from the GLFW callbacks on the main thread to the render thread */
+struct InputEvent {
+    enum Type { KEY, DRAG, SCROLL, REFRESH, DROP } type;
+    int key, action;
+    double x, y;
+};
 
 class App {
     public:
         bool isDragging = false;
         bool isInTransition = false;
         bool hasNormals = false;
+        bool hasMaterials = false;
         float textureState = 0.0f;
+        float renderTextureState = 0.0f; // textureState interpolated between the last two updates
         double lastX = 0.0, lastY = 0.0;
         float _textureTarget;
         std::unique_ptr<Mesh> _mesh;
         std::unique_ptr<Transform> _transform;
+        std::unique_ptr<InstanceSet> _instances;
 
-        App(const std::unordered_map<std::string, Object> &objects) {
+        App(const std::unordered_map<std::string, Object> &objects, BMP const &texture, Options const &options) : _options(options), _textures(options.textureBudget) {
+            try {
+                if (!options.recordPath.empty())
+                    _recorder = std::make_unique<FrameRecorder>(options.recordPath);
+                if (!options.replayPath.empty())
+                    _replay = FrameRecorder::load(options.replayPath);
+            } catch (std::exception const &e) {
+                std::cerr << e.what() << std::endl;
+                exit(1);
+            }
             init();
-            _mesh = std::make_unique<Mesh>(objects);
+            _textures.set(options.texturePath, texture);
+            reloadMesh(objects);
             _transform = std::make_unique<Transform>(WIDTH, HEIGHT);
+            _model = _previousModel = _transform->modelMat;
+            if (options.depthPrepass != "off")
+                createDepthPrepass();
+            if (options.occlusion != "off")
+                _occlusion = std::make_unique<OcclusionCuller>(options.occlusion == "gpu" ? OcclusionCuller::GPU : OcclusionCuller::CPU);
+            if (options.instanceCount) {
+                float spacing = std::max(_mesh->getBoundingRadius(), 0.01f) * 2.5f;
+                _instances = std::make_unique<InstanceSet>(InstanceSet::grid(options.instanceCount, spacing));
+            }
             std::cout << "App created successfully" << std::endl;
         }
+
+        /* Build the mesh from freshly parsed objects, replacing the current one */
+        void reloadMesh(const std::unordered_map<std::string, Object> &objects) {
+            setMesh(std::make_unique<Mesh>(objects));
+        }
+
+        /* Replace the current mesh with one built elsewhere, uploading it over the buffers of the current
+         * one where they still fit; needs the GL context */
+        void setMesh(std::unique_ptr<Mesh> mesh) {
+            mesh->upload(_mesh.get());
+            mesh->setConeCulling(_options.coneCulling);
+            mesh->setLodThreshold(_options.lodThreshold);
+            for (auto const &object : _options.objectOffsets) {
+                Matrix transform;
+                transform.move(object.offset[0], object.offset[1], object.offset[2]);
+                mesh->setObjectTransform(object.object, transform);
+            }
+            _mesh = std::move(mesh);
+            if (_occlusion)
+                _occlusion->invalidate();
+            hasNormals = _mesh->getHasNormals();
+            auto const &materials = _mesh->getMaterials();
+            hasMaterials = std::any_of(materials.begin(), materials.end(), [](Material const *m) { return m != nullptr; });
+            updateTextures();
+        }
+
+        /* Replace the texture given on the command line */
+        void setTexture(BMP const &texture) {
+            _textures.set(_options.texturePath, texture);
+            updateTextures();
+        }
+
+        /* Refresh the material table after a material library was reloaded in place */
+        void updateMaterials() {
+            updateTextures();
+        }
+
+        /* Track the diffuse and normal maps of the materials next to the main texture, they are
+         * streamed in once visible, see streamTextures() */
+        void updateTextures() {
+            std::vector<std::string> paths = {_options.texturePath};
+            for (auto const *material : _mesh->getMaterials())
+                addMaps(material, paths);
+            _textures.load(paths);
+            applyTextureRects();
+        }
+
+        /* Point the material table at the resident level of each map */
+        void applyTextureRects() {
+            std::vector<Mesh::MaterialMaps> maps;
+            for (auto const *material : _mesh->getMaterials())
+                maps.push_back(material ? Mesh::MaterialMaps{mapRect(material->_diffuseMap), mapRect(material->_normalMap)} : Mesh::MaterialMaps());
+            _mesh->setMaterialTextures(maps);
+        }
+
+        /* Report the textures sampled by the visible draws to the residency manager; frames keep
+         * coming while textures stream in, even in on-demand mode */
+        void streamTextures() {
+            auto const &materials = _mesh->getMaterials();
+            auto const &draws = _mesh->getDraws();
+            std::vector<std::string> used = {_options.texturePath};
+            std::vector<bool> seen(materials.size(), false);
+            for (auto const &range : _mesh->getRanges()) {
+                size_t materialIndex = draws[range.drawIndex].materialIndex;
+                Material const *material = materials[materialIndex];
+                if (!seen[materialIndex])
+                    addMaps(material, used);
+                seen[materialIndex] = true;
+            }
+            if (_textures.update(used))
+                applyTextureRects();
+            if (_textures.isStreaming())
+                markDirty();
+        }
+
+        /* Bind the texture array to the current program */
+        void bindTextures(Shader const &shader) {
+            _textures.bind(shader.getId(), TEXTURE_UNIT);
+            TextureRect rect = _textures.getRect(_options.texturePath);
+            shader.setVec4("textureRect", {rect.offset[0], rect.offset[1], rect.scale[0], rect.scale[1]});
+            shader.setFloat("textureLayer", rect.layer);
+        }
+
+        bool isStreamingTextures() const { return _textures.isStreaming(); }
+
+        /* Rebuild the depth pre-pass program after the vertex shader changed on disk */
+        void reloadDepthPrepass() {
+            if (_depthPrepass && !_depthPrepass->reload())
+                std::cerr << "Depth pre-pass shader reload failed, keeping the previous program" << std::endl;
+        }
+
+        /* Shader variant matching the mesh, the instancing and the texture transition */
+        unsigned shaderFeatures() const {
+            return (hasNormals ? Shader::NORMALS : 0u)
+                | (textureState > 0.0f || isInTransition ? Shader::TEXTURED : 0u)
+                | (hasMaterials ? Shader::MATERIALS : 0u)
+                | (_instances ? Shader::INSTANCED : 0u);
+        }
+
+        /* Draw the mesh once, or every visible instance in one instanced submission. Materials with a
+         * dissolve below 1 are drawn after the opaque ones, blended by the transparency pass. */
+        void drawMesh(Shader &shader) {
+            if (_instances)
+                _instances->cull(*_transform, _mesh->getBoundingCenter(), _mesh->getBoundingRadius());
+            else {
+                _mesh->cull(*_transform, HEIGHT, _occlusion.get());
+                _cullStats.frames++;
+                _cullStats.draws += _mesh->getDraws().size();
+                _cullStats.visibleDraws += _mesh->getVisibleDrawCount();
+                _cullStats.triangles += _mesh->getTriangleCount();
+                _cullStats.submittedTriangles += _mesh->getSubmittedTriangles();
+            }
+            streamTextures();
+
+            bool transparent = _mesh->hasTransparentRanges() && transparencyPass();
+            bool prepass = _depthPrepass && _depthPrepass->begin();
+            if (transparent)
+                _transparency->beginOpaque();
+            if (prepass) {
+                _depthPrepass->beginDepth(shader.getFeatures() & Shader::INSTANCED);
+                drawPass(_depthPrepass->shader(), false);
+                shader.use();
+                _depthPrepass->beginColor();
+            }
+            drawPass(shader, false);
+            if (prepass)
+                _depthPrepass->end();
+            if (_occlusion && !_instances) {
+                _occlusion->capture(_transform->projectionMat * _transform->viewMat * _transform->modelMat);
+                /* Parts hidden in the depth of an older view may be visible in this one, draw again once it catches up */
+                if (_occlusion->isStale())
+                    markDirty();
+            }
+            if (_mesh->hasTransparentRanges()) {
+                unsigned features = shader.getFeatures();
+                if (transparent && shader.select(features | Shader::OIT)) {
+                    _transparency->beginTransparent();
+                    drawPass(shader, true);
+                    shader.select(features);
+                } else {
+                    /* No transparency pass, the transparent ranges are drawn as opaque ones */
+                    drawPass(shader, true);
+                }
+            }
+            if (transparent)
+                _transparency->end();
+            _mesh->submitted();
+            if (_instances)
+                _instances->submitted();
+        }
         ~App() { glfwTerminate(); }
 
         void init() {
@@ -45,6 +247,9 @@ class App {
             glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 1);
             glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
             glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+            /* Golden image checks only render offscreen */
+            if (!_options.goldenDirectory.empty())
+                glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
 
             _window = glfwCreateWindow(WIDTH, HEIGHT, "SCOP", nullptr, nullptr);
             if (!_window) {
@@ -54,11 +259,20 @@ class App {
             }
 
             glfwMakeContextCurrent(_window);
+            /* Replays measure how fast frames can be drawn */
+            int swapInterval = _replay.empty() ? _options.swapInterval : 0;
+            if (swapInterval < 0 && !glfwExtensionSupported("GLX_EXT_swap_control_tear") && !glfwExtensionSupported("WGL_EXT_swap_control_tear")) {
+                std::cerr << "Adaptive vsync unsupported, using regular vsync" << std::endl;
+                swapInterval = 1;
+            }
+            glfwSwapInterval(swapInterval);
             glfwSetWindowUserPointer(_window, this);
             glfwSetKeyCallback(_window, App::keyCallback);
             glfwSetMouseButtonCallback(_window, App::mouseButtonCallback);
             glfwSetCursorPosCallback(_window, App::cursorPositionCallback);
             glfwSetScrollCallback(_window, App::scrollCallback);
+            glfwSetWindowRefreshCallback(_window, App::refreshCallback);
+            glfwSetDropCallback(_window, App::dropCallback);
 
             if (glewInit() != GLEW_OK) {
                 std::cerr << "Failed to initialize GLEW" << std::endl;
@@ -69,14 +283,149 @@ class App {
             std::cout << "App initialized" << std::endl;
         }
 
-        void run(std::function<void()> loop) {
-            while (!glfwWindowShouldClose(_window)) {
-                glClearColor(231.0f / 255.0f, 87.0f / 255.0f, 51.0f / 255.0f, 1.0f);
-                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-                loop();
+        /* The main thread only waits for window events, which the callbacks forward through a lock-free
+         * queue to a render thread owning the GL context, so a long frame or reload never blocks input.
+         * The context is current on the calling thread again when run() returns. */
+        void run(std::function<bool()> update, std::function<void()> render) {
+            _running = true;
+            glfwMakeContextCurrent(nullptr);
+            std::thread renderThread([&]() {
+                glfwMakeContextCurrent(_window);
+                if (_replay.empty())
+                    renderLoop(update, render);
+                else
+                    replayLoop(render);
+                glfwMakeContextCurrent(nullptr);
+            });
+
+            while (!glfwWindowShouldClose(_window))
+                glfwWaitEvents();
+
+            _running = false;
+            wake();
+            renderThread.join();
+            glfwMakeContextCurrent(_window);
+            reportCulling();
+            _textures.report();
+            if (_depthPrepass)
+                _depthPrepass->report();
+            if (_occlusion)
+                _occlusion->report();
+        }
+
+        /* `update` runs every iteration and returns true when it changed something to draw.
+         * Input and animations advance in fixed FIXED_TIMESTEP steps, whatever the frame rate,
+         * and frames are drawn with the state interpolated between the last two steps.
+         * In on-demand mode frames are only drawn when something is dirty and the thread otherwise
+         * sleeps until input arrives, waking every IDLE_TIMEOUT seconds for `update`. */
+        void renderLoop(std::function<bool()> const &update, std::function<void()> const &render) {
+            using Clock = std::chrono::steady_clock;
+            auto frameTime = std::chrono::duration_cast<Clock::duration>(
+                std::chrono::duration<double>(_options.maxFps > 0.0f ? 1.0 / _options.maxFps : 0.0));
+            auto nextFrame = Clock::now();
+            auto previous = Clock::now();
+            double accumulator = 0.0;
+
+            while (_running) {
+                processEvents();
+                if (update && update())
+                    markDirty();
+
+                auto now = Clock::now();
+                accumulator += std::min(std::chrono::duration<double>(now - previous).count(), MAX_FRAME_TIME);
+                previous = now;
+                for (; accumulator >= FIXED_TIMESTEP; accumulator -= FIXED_TIMESTEP)
+                    step(static_cast<float>(FIXED_TIMESTEP));
+                interpolate(static_cast<float>(accumulator / FIXED_TIMESTEP));
+
+                if (_dirty || !_options.onDemand) {
+                    _dirty = false;
+                    if (_recorder)
+                        _recorder->frame(_frameIndex, _transform->modelMat, renderTextureState);
+                    drawFrame(render);
+                    glfwSwapBuffers(_window);
+
+                    if (frameTime.count()) {
+                        nextFrame = std::max(nextFrame + frameTime, Clock::now());
+                        std::this_thread::sleep_until(nextFrame);
+                    }
+                }
+
+                if (_options.onDemand && !_dirty)
+                    waitForEvents(IDLE_TIMEOUT);
+            }
+        }
+
+        /* Draw the frames of the recording, or the requested number looping over it, with vsync off and
+         * input ignored, then print the frame times and close the window */
+        void replayLoop(std::function<void()> const &render) {
+            using Clock = std::chrono::steady_clock;
+            size_t frameCount = _options.replayFrames ? _options.replayFrames : _replay.size();
+            FrameTimes times;
+            auto previous = Clock::now();
+
+            for (size_t i = 0; i < frameCount && _running; i++) {
+                InputEvent event;
+                while (_events.pop(event))
+                    ;
+                RecordedFrame const &frame = _replay[i % _replay.size()];
+                _transform->modelMat.set_data(frame.model);
+                textureState = renderTextureState = frame.textureState;
+                isInTransition = false;
+                drawFrame(render);
+                if (!_options.dumpDirectory.empty())
+                    dumpFrame(_options.dumpDirectory + "/frame_" + std::to_string(100000 + i).substr(1) + ".bmp");
                 glfwSwapBuffers(_window);
-                glfwPollEvents();
+
+                auto now = Clock::now();
+                if (i >= REPLAY_WARMUP_FRAMES || frameCount <= REPLAY_WARMUP_FRAMES)
+                    times.add(std::chrono::duration<double>(now - previous).count());
+                previous = now;
             }
+
+            std::cout << "Replayed " << frameCount << " frames of " << _options.replayPath;
+            if (!_options.dumpDirectory.empty())
+                std::cout << ", saving them to " << _options.dumpDirectory << " (included in the timings)";
+            std::cout << std::endl;
+            times.report(std::cout);
+            glfwSetWindowShouldClose(_window, GLFW_TRUE);
+            glfwPostEmptyEvent();
+        }
+
+        void drawFrame(std::function<void()> const &render) {
+            glClearColor(231.0f / 255.0f, 87.0f / 255.0f, 51.0f / 255.0f, 1.0f);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            render();
+            _frameIndex++;
+        }
+
+        /* Save the back buffer before it is swapped */
+        void dumpFrame(std::string const &path) {
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            BMP image;
+            image.width = viewport[2];
+            image.height = viewport[3];
+            image.data.resize(static_cast<size_t>(image.width) * image.height * 3);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadBuffer(GL_BACK);
+            glReadPixels(viewport[0], viewport[1], viewport[2], viewport[3], GL_RGB, GL_UNSIGNED_BYTE, image.data.data());
+            if (!image.write(path))
+                std::cerr << "Failed to write frame: " << path << std::endl;
+        }
+
+        void markDirty() { _dirty = true; }
+
+        /* Path of the last obj dropped on the window since the previous call, empty if none */
+        std::string takeDroppedPath() {
+            std::lock_guard<std::mutex> lock(_droppedMutex);
+            return std::exchange(_droppedPath, std::string());
+        }
+
+        /* Called on the main thread; events are dropped if the render thread is that far behind */
+        void post(InputEvent const &event) {
+            _events.push(event);
+            wake();
         }
 
        static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
@@ -85,33 +434,13 @@ class App {
             (void) mods;
 
             App* app = static_cast<App*>(glfwGetWindowUserPointer(window));
-            if (action == GLFW_PRESS || action == GLFW_REPEAT) {
-                switch (key) {
-                    case GLFW_KEY_ESCAPE:
-                        glfwSetWindowShouldClose(window, GLFW_TRUE);
-                        break;
-                    case GLFW_KEY_T:
-                        if (app) app->applyTexture();
-                        break;
-                    case GLFW_KEY_UP:
-                    case GLFW_KEY_W:
-                        if (app) app->_transform->modelMat.move(0.f, 1.f, 0.f);
-                        break;
-                    case GLFW_KEY_DOWN:
-                    case GLFW_KEY_S:
-                        if (app) app->_transform->modelMat.move(0.f, -1.f, 0.f);
-                        break;
-                    case GLFW_KEY_LEFT:
-                    case GLFW_KEY_A:
-                        if (app) app->_transform->modelMat.move(-1.f, 0.f, 0.f);
-                        break;
-                    case GLFW_KEY_RIGHT:
-                    case GLFW_KEY_D:
-                        if (app) app->_transform->modelMat.move(1.f, 0.f, 0.f);
-                        break;
-                    // Add more cases as needed
-                }
+            if (key == GLFW_KEY_ESCAPE && action == GLFW_PRESS) {
+                glfwSetWindowShouldClose(window, GLFW_TRUE);
+                return;
             }
+            // Everything else is handled by the render thread, see processEvents()
+            if (app)
+                app->post({InputEvent::KEY, key, action, 0.0, 0.0});
         }
 
         static void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
@@ -137,7 +466,7 @@ class App {
             app->lastY = ypos;
 
             if (app->isDragging)
-                app->moveCamera(deltaX, deltaY);
+                app->post({InputEvent::DRAG, 0, 0, deltaX, deltaY});
         }
 
         static void scrollCallback(GLFWwindow* window, double xoffset, double yoffset) {
@@ -145,13 +474,38 @@ class App {
     
             App* app = static_cast<App*>(glfwGetWindowUserPointer(window));
             if (app)
-                app->handleZoom(yoffset);
+                app->post({InputEvent::SCROLL, 0, 0, 0.0, yoffset});
+        }
+
+        static void refreshCallback(GLFWwindow* window) {
+            App* app = static_cast<App*>(glfwGetWindowUserPointer(window));
+            if (app)
+                app->post({InputEvent::REFRESH, 0, 0, 0.0, 0.0});
+        }
+
+        /* The path is handed over separately, events stay trivially copyable for the queue */
+        static void dropCallback(GLFWwindow* window, int count, const char* paths[]) {
+            App* app = static_cast<App*>(glfwGetWindowUserPointer(window));
+            if (!app)
+                return;
+            for (int i = count - 1; i >= 0; i--) {
+                std::string path = paths[i];
+                if (path.size() < 4 || path.compare(path.size() - 4, 4, ".obj") != 0)
+                    continue;
+                {
+                    std::lock_guard<std::mutex> lock(app->_droppedMutex);
+                    app->_droppedPath = path;
+                }
+                app->post({InputEvent::DROP, 0, 0, 0.0, 0.0});
+                return;
+            }
+            std::cerr << "Only obj files can be dropped on the window" << std::endl;
         }
 
         void handleZoom(double yoffset) {
             float dz = yoffset * 0.1f;
         
-            _transform->modelMat.move(0.0f, 0.0f, dz);
+            _model.move(0.0f, 0.0f, dz);
         }
 
         void moveCamera(double deltaX, double deltaY) {
@@ -160,8 +514,8 @@ class App {
             float angleX = static_cast<float>(deltaY) * sensitivity;
             float angleY = static_cast<float>(deltaX) * sensitivity;
 
-            _transform->modelMat.rotate(angleY, 0.0f, 1.0f, 0.0f);
-            _transform->modelMat.rotate(angleX, 1.0f, 0.0f, 0.0f);
+            _model.rotate(angleY, 0.0f, 1.0f, 0.0f);
+            _model.rotate(angleX, 1.0f, 0.0f, 0.0f);
         }
 
         	void applyTexture() {
@@ -170,28 +524,200 @@ class App {
                 isInTransition = true;
             }
 
-            void updateTextureTransition(GLuint _id) {
-                    /* Move is_texture_enabled towards target value */ 
+            /* Move textureState towards the target value */
+            void advanceTextureTransition(float dt) {
                     if (textureState < _textureTarget) {
-                        textureState += TRANSITION_SPEED;
+                        textureState += TRANSITION_SPEED * dt;
                         if (textureState > _textureTarget) {
                             textureState = _textureTarget;
                             isInTransition = false;
                         }
                     } else {
-                        textureState -= TRANSITION_SPEED;
+                        textureState -= TRANSITION_SPEED * dt;
                         if (textureState < _textureTarget) {
                             textureState = _textureTarget;
                             isInTransition = false;
                         }
                     }
-
-                    GLint textureStateLoc = glGetUniformLocation(_id, "textureState");
-                    glUniform1f(textureStateLoc, textureState);
             }
 
-
     private:
         GLFWwindow* _window;
+        Options _options;
+        TextureManager _textures;
+        std::unique_ptr<TransparencyPass> _transparency; // Created on the first frame with transparent draws
+        bool _transparencyFailed = false;
+        std::unique_ptr<DepthPrepass> _depthPrepass;
+        std::unique_ptr<OcclusionCuller> _occlusion; // Only used without instancing
+        std::unique_ptr<FrameRecorder> _recorder;
+        std::vector<RecordedFrame> _replay;
+        size_t _frameIndex = 0; // Frames drawn so far
+        bool _dirty = true;
+        bool _changedLastStep = false;
+        double _pendingRotation[2] = {0.0, 0.0}; // Cursor travel while dragging, applied on the next step
+        double _pendingZoom = 0.0;
+        Matrix _model, _previousModel; // Model matrix after the last two steps
+
+        /* Frustum culling totals summed over the frames drawn without instancing */
+        struct CullStats {
+            size_t frames = 0;
+            size_t draws = 0, visibleDraws = 0;
+            size_t triangles = 0, submittedTriangles = 0;
+        } _cullStats;
+
+        void reportCulling() const {
+            if (!_cullStats.frames)
+                return;
+            double frames = static_cast<double>(_cullStats.frames);
+            auto precision = std::cout.precision();
+            std::cout << std::fixed << std::setprecision(1) << "Frustum culling: " << _cullStats.visibleDraws / frames << " of " << _cullStats.draws / frames
+                << " draws visible, " << _cullStats.submittedTriangles / frames << " of " << _cullStats.triangles / frames
+                << " triangles submitted per frame over " << _cullStats.frames << " frames" << std::endl;
+            std::cout.unsetf(std::ios::fixed);
+            std::cout.precision(precision);
+        }
+
+        void createDepthPrepass() {
+            try {
+                _depthPrepass = std::make_unique<DepthPrepass>(
+                    _options.depthPrepass == "on" ? DepthPrepass::ALWAYS : DepthPrepass::AUTO, _options.overdrawThreshold);
+            } catch (std::exception const &) {
+                std::cerr << "Depth pre-pass unavailable" << std::endl;
+            }
+        }
+
+        /* Texture paths of the maps of a material */
+        static void addMaps(Material const *material, std::vector<std::string> &paths) {
+            if (material && !material->_diffuseMap.empty())
+                paths.push_back(material->_diffuseMap);
+            if (material && !material->_normalMap.empty())
+                paths.push_back(material->_normalMap);
+        }
+
+        TextureRect mapRect(std::string const &path) const {
+            return path.empty() ? TextureRect() : _textures.getRect(path);
+        }
+
+        /* The transparency pass, created when first needed; false if its shaders do not build */
+        bool transparencyPass() {
+            if (!_transparency && !_transparencyFailed) {
+                /* Building the composite program makes it current, the frame goes on with the caller's */
+                GLint program = 0;
+                glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+                try {
+                    _transparency = std::make_unique<TransparencyPass>();
+                } catch (std::exception const &) {
+                    std::cerr << "Transparency pass unavailable, transparent materials are drawn opaque" << std::endl;
+                    _transparencyFailed = true;
+                }
+                glUseProgram(program);
+            }
+            return _transparency != nullptr;
+        }
+
+        /* Draw the opaque or the transparent ranges with the current program */
+        void drawPass(Shader const &shader, bool transparent) {
+            bindTextures(shader);
+            if (!_instances) {
+                _mesh->draw(shader, 1, transparent);
+                return;
+            }
+            GLsizei visible = _instances->bind(shader.getId(), INSTANCE_DATA_UNIT);
+            if (visible)
+                _mesh->draw(shader, visible, transparent);
+        }
+
+        /* Advance the simulation by dt seconds: held keys, pending mouse input and the texture transition */
+        void step(float dt) {
+            _previousModel = _model;
+            _previousTextureState = textureState;
+            bool changed = false;
+
+            float dx = 0.0f, dy = 0.0f;
+            if (isHeld(GLFW_KEY_UP) || isHeld(GLFW_KEY_W)) dy += 1.0f;
+            if (isHeld(GLFW_KEY_DOWN) || isHeld(GLFW_KEY_S)) dy -= 1.0f;
+            if (isHeld(GLFW_KEY_LEFT) || isHeld(GLFW_KEY_A)) dx -= 1.0f;
+            if (isHeld(GLFW_KEY_RIGHT) || isHeld(GLFW_KEY_D)) dx += 1.0f;
+            if (dx != 0.0f || dy != 0.0f) {
+                _model.move(dx * MOVE_SPEED * dt, dy * MOVE_SPEED * dt, 0.0f);
+                changed = true;
+            }
+            if (_pendingRotation[0] != 0.0 || _pendingRotation[1] != 0.0) {
+                moveCamera(_pendingRotation[0], _pendingRotation[1]);
+                _pendingRotation[0] = _pendingRotation[1] = 0.0;
+                changed = true;
+            }
+            if (_pendingZoom != 0.0) {
+                handleZoom(_pendingZoom);
+                _pendingZoom = 0.0;
+                changed = true;
+            }
+            if (isInTransition) {
+                advanceTextureTransition(dt);
+                changed = true;
+            }
+
+            /* One more frame after the last change, so the interpolation reaches the final state */
+            if (changed || _changedLastStep)
+                markDirty();
+            _changedLastStep = changed;
+        }
+
+        void interpolate(float alpha) {
+            _transform->modelMat = Matrix::lerp(_previousModel, _model, alpha);
+            renderTextureState = _previousTextureState + (textureState - _previousTextureState) * alpha;
+        }
+
+        bool isHeld(int key) const { return _heldKeys[key]; }
+
+        /* Render thread side of the input queue */
+        void processEvents() {
+            InputEvent event;
+            while (_events.pop(event)) {
+                markDirty();
+                if (_recorder)
+                    _recorder->event(_frameIndex, event.type, event.key, event.action, event.x, event.y);
+                switch (event.type) {
+                    case InputEvent::KEY:
+                        if (event.key >= 0 && event.key <= GLFW_KEY_LAST)
+                            _heldKeys[event.key] = event.action != GLFW_RELEASE;
+                        if (event.key == GLFW_KEY_T && event.action != GLFW_RELEASE)
+                            applyTexture();
+                        // Movement keys are read while held, in step()
+                        break;
+                    case InputEvent::DRAG:
+                        _pendingRotation[0] += event.x;
+                        _pendingRotation[1] += event.y;
+                        break;
+                    case InputEvent::SCROLL:
+                        _pendingZoom += event.y;
+                        break;
+                    case InputEvent::REFRESH:
+                    case InputEvent::DROP: // Picked up by the update callback, see takeDroppedPath()
+                        break;
+                }
+            }
+        }
+
+        void waitForEvents(double timeout) {
+            std::unique_lock<std::mutex> lock(_wakeMutex);
+            _wake.wait_for(lock, std::chrono::duration<double>(timeout), [this]() { return !_events.empty() || !_running; });
+        }
+
+        /* Taking the lock orders the notification after a concurrent waiter checked its predicate */
+        void wake() {
+            { std::lock_guard<std::mutex> lock(_wakeMutex); }
+            _wake.notify_one();
+        }
+
+        SpscQueue<InputEvent, INPUT_QUEUE_SIZE> _events;
+        std::array<bool, GLFW_KEY_LAST + 1> _heldKeys{};
+        std::atomic<bool> _running{false};
+        std::mutex _wakeMutex;
+        std::condition_variable _wake;
+        std::mutex _droppedMutex;
+        std::string _droppedPath;
+
+        float _previousTextureState = 0.0f;
 
 };
\ No newline at end of file
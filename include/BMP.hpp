@@ -1,8 +1,48 @@
 #pragma once
 
 #include <vector>
+#include <string>
+#include <fstream>
 
+/* RGB pixels, rows from the bottom up like in the file and in GL */
 struct BMP {
     unsigned int width, height;
     std::vector<unsigned char> data;
+
+    /* Encode as a 24 bits BMP file, false if it cannot be written */
+    bool write(std::string const &path) const {
+        std::ofstream file(path, std::ios::binary);
+        if (!file.is_open())
+            return false;
+
+        unsigned int rowPadded = (width * 3 + 3) & (~3);
+        unsigned int imageSize = rowPadded * height;
+        unsigned char header[54] = {'B', 'M'};
+        auto put = [&header](int offset, unsigned int value) {
+            for (int k = 0; k < 4; k++)
+                header[offset + k] = static_cast<unsigned char>(value >> (k * 8));
+        };
+        put(2, 54 + imageSize);
+        put(10, 54);
+        put(14, 40);
+        put(18, width);
+        put(22, height);
+        header[26] = 1;
+        header[28] = 24;
+        put(34, imageSize);
+        file.write(reinterpret_cast<const char*>(header), 54);
+
+        std::vector<unsigned char> row(rowPadded, 0);
+        for (unsigned int y = 0; y < height; ++y) {
+            for (unsigned int x = 0; x < width; ++x) {
+                unsigned long idx = (x + y * width) * 3;
+                /* BGR */
+                row[x * 3 + 0] = data[idx + 2];
+                row[x * 3 + 1] = data[idx + 1];
+                row[x * 3 + 2] = data[idx + 0];
+            }
+            file.write(reinterpret_cast<const char*>(row.data()), rowPadded);
+        }
+        return static_cast<bool>(file);
+    }
 };
\ No newline at end of file
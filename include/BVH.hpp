@@ -0,0 +1,160 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <limits>
+#include <algorithm>
+#include <cstdint>
+
+#include "Frustum.hpp"
+
+struct AABB {
+    std::array<float, 3> min = {
+        std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max()
+    };
+    std::array<float, 3> max = {
+        std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()
+    };
+
+    void expand(float x, float y, float z) {
+        min = {std::min(min[0], x), std::min(min[1], y), std::min(min[2], z)};
+        max = {std::max(max[0], x), std::max(max[1], y), std::max(max[2], z)};
+    }
+
+    void expand(AABB const &other) {
+        if (!other.isValid())
+            return;
+        expand(other.min[0], other.min[1], other.min[2]);
+        expand(other.max[0], other.max[1], other.max[2]);
+    }
+
+    bool isValid() const { return min[0] <= max[0]; }
+    float center(int axis) const { return (min[axis] + max[axis]) * 0.5f; }
+
+    /* Bounds of this box once transformed by a column-major affine matrix (Arvo) */
+    AABB transformed(const float *m) const {
+        AABB result;
+        if (!isValid())
+            return result;
+        for (int row = 0; row < 3; row++) {
+            result.min[row] = result.max[row] = m[row + 12];
+            for (int col = 0; col < 3; col++) {
+                float a = m[row + col * 4] * min[col];
+                float b = m[row + col * 4] * max[col];
+                result.min[row] += std::min(a, b);
+                result.max[row] += std::max(a, b);
+            }
+        }
+        return result;
+    }
+};
+
+/* Bounding volume hierarchy over a list of boxes, used to cull whole subtrees of draws at once.
+ * Every node covers a contiguous range of _items so a subtree fully inside the frustum is
+ * emitted without visiting its children. */
+class BVH {
+    public:
+        void build(std::vector<AABB> const &leaves) {
+            _nodes.clear();
+            _items.resize(leaves.size());
+            for (size_t i = 0; i < leaves.size(); i++)
+                _items[i] = static_cast<uint32_t>(i);
+            if (leaves.empty())
+                return;
+            _nodes.reserve(leaves.size() * 2);
+            _nodes.push_back({AABB(), 0, static_cast<uint32_t>(leaves.size()), LEAF});
+            buildNode(leaves, 0);
+        }
+
+        /* Recompute the node bounds after leaves moved, keeping the topology.
+         * Children are always stored after their parent so a reverse sweep is bottom-up. */
+        void refit(std::vector<AABB> const &leaves) {
+            for (size_t i = _nodes.size(); i-- > 0;) {
+                Node &node = _nodes[i];
+                node.bounds = AABB();
+                if (node.left == LEAF) {
+                    for (uint32_t j = node.first; j < node.first + node.count; j++)
+                        node.bounds.expand(leaves[_items[j]]);
+                } else {
+                    node.bounds.expand(_nodes[node.left].bounds);
+                    node.bounds.expand(_nodes[node.left + 1].bounds);
+                }
+            }
+        }
+
+        /* Call visit(leafIndex) for every leaf whose box is not entirely outside the frustum */
+        template <typename Visitor>
+        void query(Frustum const &frustum, std::vector<AABB> const &leaves, Visitor &&visit) const {
+            if (_nodes.empty())
+                return;
+
+            uint32_t stack[64];
+            size_t top = 0;
+            stack[top++] = 0;
+            while (top) {
+                Node const &node = _nodes[stack[--top]];
+                Frustum::Visibility visibility = frustum.classifyBox(node.bounds.min, node.bounds.max);
+                if (visibility == Frustum::OUTSIDE)
+                    continue;
+
+                if (visibility == Frustum::INSIDE) {
+                    for (uint32_t j = node.first; j < node.first + node.count; j++)
+                        visit(_items[j]);
+                } else if (node.left == LEAF) {
+                    for (uint32_t j = node.first; j < node.first + node.count; j++)
+                        if (frustum.classifyBox(leaves[_items[j]].min, leaves[_items[j]].max) != Frustum::OUTSIDE)
+                            visit(_items[j]);
+                } else {
+                    stack[top++] = node.left;
+                    stack[top++] = node.left + 1;
+                }
+            }
+        }
+
+        size_t getNodeCount() const { return _nodes.size(); }
+
+    private:
+        static constexpr uint32_t LEAF = std::numeric_limits<uint32_t>::max();
+        static constexpr uint32_t MAX_LEAF_SIZE = 4;
+
+        struct Node {
+            AABB bounds;
+            uint32_t first, count;
+            uint32_t left; // Right child is left + 1, LEAF for leaves
+        };
+
+        std::vector<Node> _nodes;
+        std::vector<uint32_t> _items;
+
+        /* Compute the bounds of an allocated node and split it at the median of the longest
+         * centroid axis; both children are allocated next to each other before recursing */
+        void buildNode(std::vector<AABB> const &leaves, uint32_t index) {
+            uint32_t first = _nodes[index].first, count = _nodes[index].count;
+
+            AABB centroids;
+            for (uint32_t j = first; j < first + count; j++) {
+                _nodes[index].bounds.expand(leaves[_items[j]]);
+                auto const &leaf = leaves[_items[j]];
+                if (leaf.isValid())
+                    centroids.expand(leaf.center(0), leaf.center(1), leaf.center(2));
+            }
+            if (count <= MAX_LEAF_SIZE || !centroids.isValid())
+                return;
+
+            int axis = 0;
+            for (int a = 1; a < 3; a++)
+                if (centroids.max[a] - centroids.min[a] > centroids.max[axis] - centroids.min[axis])
+                    axis = a;
+
+            uint32_t half = count / 2;
+            std::nth_element(_items.begin() + first, _items.begin() + first + half, _items.begin() + first + count,
+                [&](uint32_t a, uint32_t b) { return leaves[a].center(axis) < leaves[b].center(axis); });
+
+            uint32_t left = static_cast<uint32_t>(_nodes.size());
+            _nodes.push_back({AABB(), first, half, LEAF});
+            _nodes.push_back({AABB(), first + half, count - half, LEAF});
+            _nodes[index].left = left;
+            buildNode(leaves, left);
+            buildNode(leaves, left + 1);
+        }
+};
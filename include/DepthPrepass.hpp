@@ -0,0 +1,129 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <iostream>
+#include <array>
+
+#include "Shader.hpp"
+
+/* Depth-only pre-pass followed by a GL_EQUAL color pass, so the fragment shader runs once per
+ * visible pixel instead of once per rasterized fragment. The pre-pass costs a second geometry
+ * pass, so in AUTO mode it is only kept while the measured overdraw exceeds the threshold.
+ *
+ * Overdraw is counted with occlusion queries on pre-pass frames: the depth pass counts the
+ * fragments passing GL_LESS in submission order, which is what the color pass would shade
+ * without it, and the GL_EQUAL pass counts the visible ones. While the pre-pass is off, one frame
+ * every PROBE_INTERVAL uses it to keep measuring. Results are read a few frames later, never
+ * waiting on the GPU. */
+class DepthPrepass {
+    public:
+        enum Mode { AUTO, ALWAYS, NEVER };
+
+        static constexpr unsigned PROBE_INTERVAL = 30;
+        static constexpr size_t QUERY_FRAMES = 4;
+        static constexpr float HYSTERESIS = 0.75f; // Turned off again below threshold * HYSTERESIS
+
+        DepthPrepass(Mode mode, float threshold)
+            : _shader("shaders/vertex_shader.glsl", "shaders/depth_fragment.glsl", 0), _mode(mode), _threshold(threshold) {
+            for (auto &frame : _queries) {
+                glGenQueries(2, frame.ids);
+                frame.pending = false;
+            }
+        }
+        ~DepthPrepass() {
+            for (auto &frame : _queries)
+                glDeleteQueries(2, frame.ids);
+        }
+        DepthPrepass(DepthPrepass const &) = delete;
+        DepthPrepass &operator=(DepthPrepass const &) = delete;
+
+        /* Whether the next frame draws the pre-pass, reading the overdraw measured by earlier frames */
+        bool begin() {
+            collect();
+            _frame++;
+            if (_mode == NEVER)
+                return false;
+            return _mode == ALWAYS || _enabled || _frame % PROBE_INTERVAL == 0;
+        }
+
+        /* Depth-only state for the opaque ranges, drawn with shader() in the variant for `features`,
+         * the vertex features of the color pass so that positions match */
+        void beginDepth(unsigned features) {
+            Query &query = _queries[_frame % QUERY_FRAMES];
+            _measuring = !query.pending;
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            if (_measuring)
+                glBeginQuery(GL_SAMPLES_PASSED, query.ids[0]);
+            _shader.select(features);
+        }
+
+        /* Shade only the fragments matching the pre-pass depth */
+        void beginColor() {
+            Query &query = _queries[_frame % QUERY_FRAMES];
+            if (_measuring) {
+                glEndQuery(GL_SAMPLES_PASSED);
+                glBeginQuery(GL_SAMPLES_PASSED, query.ids[1]);
+            }
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+        }
+
+        void end() {
+            if (_measuring) {
+                glEndQuery(GL_SAMPLES_PASSED);
+                _queries[_frame % QUERY_FRAMES].pending = true;
+            }
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
+            _prepassFrames++;
+        }
+
+        Shader &shader() { return _shader; }
+
+        /* Rebuild the depth program after the vertex shader changed, positions must match the color pass */
+        bool reload() { return _shader.reload(); }
+
+        void report() const {
+            std::cout << "Depth pre-pass: " << _prepassFrames << " of " << _frame << " frames, overdraw "
+                << _overdraw << " (threshold " << _threshold << ")" << std::endl;
+        }
+
+    private:
+        struct Query {
+            GLuint ids[2]; // Samples passing the depth pass, then the color pass
+            bool pending;
+        };
+
+        Shader _shader;
+        Mode _mode;
+        float _threshold;
+        std::array<Query, QUERY_FRAMES> _queries;
+        unsigned long _frame = 0, _prepassFrames = 0;
+        bool _enabled = false, _measuring = false;
+        float _overdraw = 0.0f;
+
+        /* Read the queries the GPU has finished with and update the AUTO decision from the latest one */
+        void collect() {
+            for (size_t k = 1; k <= QUERY_FRAMES; k++) {
+                Query &query = _queries[(_frame + k) % QUERY_FRAMES];
+                if (!query.pending)
+                    continue;
+                GLuint available = 0;
+                glGetQueryObjectuiv(query.ids[1], GL_QUERY_RESULT_AVAILABLE, &available);
+                if (!available)
+                    continue;
+                GLuint64 shaded = 0, visible = 0;
+                glGetQueryObjectui64v(query.ids[0], GL_QUERY_RESULT, &shaded);
+                glGetQueryObjectui64v(query.ids[1], GL_QUERY_RESULT, &visible);
+                query.pending = false;
+                if (!visible)
+                    continue;
+                _overdraw = static_cast<float>(shaded) / static_cast<float>(visible);
+                if (_overdraw > _threshold)
+                    _enabled = true;
+                else if (_overdraw < _threshold * HYSTERESIS)
+                    _enabled = false;
+            }
+        }
+};
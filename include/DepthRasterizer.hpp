@@ -0,0 +1,179 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "Matrix.hpp"
+#include "MeshVertex.hpp"
+
+/* Software depth buffer for occlusion culling when no GPU depth is available, one depth pixel per
+ * SAMPLE_GRID x SAMPLE_GRID block of the viewport. Depth matches the GL conventions used by HiZBuffer.
+ * The buffer is conservative: triangles are sampled at the centers of the viewport pixels, like the
+ * GPU draws them, and a depth pixel is only written once every one of its samples is covered, with
+ * the farthest depth of the triangles that covered them. Coverage accumulates over triangles, so
+ * the pixels along edges shared by adjacent triangles are filled as well. The samples of a row are
+ * tested four at a time when SSE is available. Triangles crossing the near plane are skipped rather
+ * than clipped: missing occluders only make the culling less effective, never wrong. */
+class DepthRasterizer {
+    public:
+        static constexpr int SAMPLE_GRID = 4; // Viewport pixels per side of a depth pixel
+        static constexpr uint32_t FULL_COVERAGE = (1u << (SAMPLE_GRID * SAMPLE_GRID)) - 1;
+
+        /* Start a frame for a viewport of the given size in pixels */
+        void clear(Matrix const &clip, int viewportWidth, int viewportHeight) {
+            _clip = clip;
+            _viewportWidth = viewportWidth;
+            _viewportHeight = viewportHeight;
+            _width = std::max(1, (viewportWidth + SAMPLE_GRID - 1) / SAMPLE_GRID);
+            _height = std::max(1, (viewportHeight + SAMPLE_GRID - 1) / SAMPLE_GRID);
+            size_t size = static_cast<size_t>(_width) * _height;
+            _depth.assign(size, 1.0f);
+            _coverage.assign(size, 0);
+            _coverageDepth.assign(size, 0.0f);
+        }
+
+        /* Rasterize indexCount / 3 triangles of `indices` starting at `indexOffset`, each vertex
+         * transformed by `transform` (column-major, may be null) before the clip matrix */
+        void drawTriangles(std::vector<MeshVertex> const &vertices, std::vector<GLuint> const &indices,
+            size_t indexOffset, size_t indexCount, const float *transform) {
+            float m[16];
+            const float *c = _clip.get_data();
+            for (int col = 0; col < 4; col++)
+                for (int row = 0; row < 4; row++) {
+                    m[row + col * 4] = 0.0f;
+                    for (int k = 0; k < 4; k++)
+                        m[row + col * 4] += c[row + k * 4] * (transform ? transform[k + col * 4] : (k == col ? 1.0f : 0.0f));
+                }
+
+            for (size_t i = indexOffset; i + 2 < indexOffset + indexCount; i += 3) {
+                float screen[3][3];
+                bool visible = true;
+                for (int k = 0; k < 3 && visible; k++) {
+                    auto const &p = vertices[indices[i + k]].position;
+                    float clip[4];
+                    for (int row = 0; row < 4; row++)
+                        clip[row] = m[row] * p[0] + m[row + 4] * p[1] + m[row + 8] * p[2] + m[row + 12];
+                    visible = clip[3] > 1e-5f && clip[2] >= -clip[3];
+                    screen[k][0] = (clip[0] / clip[3] * 0.5f + 0.5f) * _viewportWidth;
+                    screen[k][1] = (clip[1] / clip[3] * 0.5f + 0.5f) * _viewportHeight;
+                    screen[k][2] = clip[2] / clip[3] * 0.5f + 0.5f;
+                }
+                if (visible)
+                    rasterize(screen);
+            }
+        }
+
+        std::vector<float> const &getDepth() const { return _depth; }
+        int getWidth() const { return _width; }
+        int getHeight() const { return _height; }
+        int getViewportWidth() const { return _viewportWidth; }
+        int getViewportHeight() const { return _viewportHeight; }
+
+    private:
+        int _viewportWidth = 0, _viewportHeight = 0;
+        int _width = 0, _height = 0;
+        Matrix _clip;
+        std::vector<float> _depth;
+        std::vector<uint16_t> _coverage;  // Samples covered since the pixel was last written
+        std::vector<float> _coverageDepth; // Farthest depth of the triangles that covered them
+
+        static_assert(SAMPLE_GRID == 4, "Coverage is tested one row of four samples at a time");
+
+        /* `v` in viewport pixels and window depth */
+        void rasterize(float const (&v)[3][3]) {
+            float area = (v[1][0] - v[0][0]) * (v[2][1] - v[0][1]) - (v[1][1] - v[0][1]) * (v[2][0] - v[0][0]);
+            if (std::fabs(area) < 1e-8f)
+                return;
+            /* Counter-clockwise order so every edge function is positive inside */
+            int second = area > 0.0f ? 1 : 2, third = area > 0.0f ? 2 : 1;
+            float const *p0 = v[0], *p1 = v[second], *p2 = v[third];
+            area = std::fabs(area);
+
+            int minX = std::max(0, static_cast<int>(std::floor(std::min({p0[0], p1[0], p2[0]}) / SAMPLE_GRID)));
+            int maxX = std::min(_width - 1, static_cast<int>(std::floor(std::max({p0[0], p1[0], p2[0]}) / SAMPLE_GRID)));
+            int minY = std::max(0, static_cast<int>(std::floor(std::min({p0[1], p1[1], p2[1]}) / SAMPLE_GRID)));
+            int maxY = std::min(_height - 1, static_cast<int>(std::floor(std::max({p0[1], p1[1], p2[1]}) / SAMPLE_GRID)));
+            if (minX > maxX || minY > maxY)
+                return;
+
+            /* Edge function of the edge facing vertex k: e(x, y) = a * x + b * y + c */
+            float const *from[3] = {p1, p2, p0}, *to[3] = {p2, p0, p1};
+            float a[3], b[3], c[3];
+            for (int k = 0; k < 3; k++) {
+                a[k] = from[k][1] - to[k][1];
+                b[k] = to[k][0] - from[k][0];
+                c[k] = from[k][0] * to[k][1] - from[k][1] * to[k][0];
+            }
+            /* Depth as a plane over the screen, from the barycentric weights */
+            float za = (a[0] * p0[2] + a[1] * p1[2] + a[2] * p2[2]) / area;
+            float zb = (b[0] * p0[2] + b[1] * p1[2] + b[2] * p2[2]) / area;
+            float zc = (c[0] * p0[2] + c[1] * p1[2] + c[2] * p2[2]) / area;
+            /* From the center of a depth pixel to its farthest sample */
+            float zSpread = (SAMPLE_GRID - 1) * 0.5f * (std::fabs(za) + std::fabs(zb));
+
+            for (int y = minY; y <= maxY; y++) {
+                for (int x = minX; x <= maxX; x++) {
+                    uint32_t mask = coverage(x, y, a, b, c);
+                    if (!mask)
+                        continue;
+                    float cx = (x + 0.5f) * SAMPLE_GRID, cy = (y + 0.5f) * SAMPLE_GRID;
+                    merge(static_cast<size_t>(y) * _width + x, mask, za * cx + zb * cy + zc + zSpread);
+                }
+            }
+        }
+
+        /* Samples of the depth pixel inside the triangle, bit row * SAMPLE_GRID + column */
+        static uint32_t coverage(int x, int y, float const (&a)[3], float const (&b)[3], float const (&c)[3]) {
+            uint32_t mask = 0;
+            float x0 = static_cast<float>(x * SAMPLE_GRID), y0 = static_cast<float>(y * SAMPLE_GRID);
+#if defined(__SSE__)
+            const __m128 zero = _mm_setzero_ps();
+            __m128 px = _mm_add_ps(_mm_set1_ps(x0), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+            __m128 ax[3];
+            for (int k = 0; k < 3; k++)
+                ax[k] = _mm_mul_ps(_mm_set1_ps(a[k]), px);
+            for (int row = 0; row < SAMPLE_GRID; row++) {
+                float py = y0 + row + 0.5f;
+                __m128 inside = _mm_cmpge_ps(_mm_add_ps(ax[0], _mm_set1_ps(b[0] * py + c[0])), zero);
+                for (int k = 1; k < 3; k++)
+                    inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(ax[k], _mm_set1_ps(b[k] * py + c[k])), zero));
+                mask |= static_cast<uint32_t>(_mm_movemask_ps(inside)) << (row * SAMPLE_GRID);
+            }
+#else
+            for (int row = 0; row < SAMPLE_GRID; row++) {
+                float py = y0 + row + 0.5f;
+                for (int column = 0; column < SAMPLE_GRID; column++) {
+                    float px = x0 + column + 0.5f;
+                    if (a[0] * px + b[0] * py + c[0] >= 0.0f && a[1] * px + b[1] * py + c[1] >= 0.0f
+                        && a[2] * px + b[2] * py + c[2] >= 0.0f)
+                        mask |= 1u << (row * SAMPLE_GRID + column);
+                }
+            }
+#endif
+            return mask;
+        }
+
+        /* `depth` bounds the triangle over every sample of the pixel. A triangle covering the whole pixel
+         * is written directly; partial coverage is accumulated until the pixel is full, then written
+         * with the farthest depth seen and started over. */
+        void merge(size_t index, uint32_t mask, float depth) {
+            if (mask == FULL_COVERAGE) {
+                _depth[index] = std::min(_depth[index], depth);
+                return;
+            }
+            _coverage[index] |= static_cast<uint16_t>(mask);
+            _coverageDepth[index] = std::max(_coverageDepth[index], depth);
+            if (_coverage[index] == FULL_COVERAGE) {
+                _depth[index] = std::min(_depth[index], _coverageDepth[index]);
+                _coverage[index] = 0;
+                _coverageDepth[index] = 0.0f;
+            }
+        }
+};
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include <iostream>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+/* Reports which of the watched files changed since the last poll.
+ * On Linux the parent directories are watched with inotify, which also catches editors saving
+ * through a temporary file and a rename. Elsewhere, or if inotify is unavailable, modification
+ * times are polled and a change is only reported once the time is stable across two polls,
+ * so a file still being written is not read half way. */
+class FileWatcher {
+    public:
+        /* Modification times are not checked more often than this */
+        static constexpr std::chrono::milliseconds POLL_INTERVAL{250};
+
+        FileWatcher() {
+#ifdef __linux__
+            _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+            if (_fd < 0)
+                std::cerr << "inotify unavailable, polling modification times instead" << std::endl;
+#endif
+        }
+
+        ~FileWatcher() {
+#ifdef __linux__
+            if (_fd >= 0)
+                close(_fd);
+#endif
+        }
+
+        FileWatcher(FileWatcher const &) = delete;
+        FileWatcher &operator=(FileWatcher const &) = delete;
+
+        void watch(std::string const &path) {
+            if (_files.count(path))
+                return;
+            _files[path] = {modificationTime(path), 0};
+#ifdef __linux__
+            if (_fd < 0)
+                return;
+            size_t slash = path.find_last_of('/');
+            std::string directory = slash == std::string::npos ? "." : path.substr(0, slash);
+            std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+            auto it = std::find_if(_directories.begin(), _directories.end(),
+                [&](auto const &entry) { return entry.second.path == directory; });
+            if (it == _directories.end()) {
+                int wd = inotify_add_watch(_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+                if (wd < 0) {
+                    std::cerr << "Failed to watch directory: " << directory << std::endl;
+                    return;
+                }
+                it = _directories.emplace(wd, Directory{directory, {}}).first;
+            }
+            it->second.files.emplace(name, path);
+#endif
+        }
+
+        std::vector<std::string> poll() {
+            std::vector<std::string> changed;
+#ifdef __linux__
+            if (_fd >= 0) {
+                pollEvents(changed);
+                return changed;
+            }
+#endif
+            auto now = std::chrono::steady_clock::now();
+            if (now - _lastPoll < POLL_INTERVAL)
+                return changed;
+            _lastPoll = now;
+
+            for (auto &file : _files) {
+                time_t time = modificationTime(file.first);
+                if (time == file.second.reported)
+                    continue;
+                if (time == file.second.seen) {
+                    file.second.reported = time;
+                    changed.push_back(file.first);
+                }
+                file.second.seen = time;
+            }
+            return changed;
+        }
+
+    private:
+        struct Times {
+            time_t reported; // Time of the last version handed out
+            time_t seen;     // Time observed on the previous poll
+        };
+
+        std::map<std::string, Times> _files;
+        std::chrono::steady_clock::time_point _lastPoll;
+
+        static time_t modificationTime(std::string const &path) {
+            struct stat info;
+            return stat(path.c_str(), &info) == 0 ? info.st_mtime : 0;
+        }
+
+#ifdef __linux__
+        struct Directory {
+            std::string path;
+            std::map<std::string, std::string> files; // name in the directory -> watched path
+        };
+
+        int _fd = -1;
+        std::map<int, Directory> _directories;
+
+        void pollEvents(std::vector<std::string> &changed) {
+            alignas(inotify_event) char buffer[4096];
+            for (;;) {
+                ssize_t length = read(_fd, buffer, sizeof(buffer));
+                if (length <= 0) {
+                    if (length < 0 && errno != EAGAIN)
+                        std::cerr << "Failed to read file events" << std::endl;
+                    return;
+                }
+                for (ssize_t offset = 0; offset < length;) {
+                    auto *event = reinterpret_cast<inotify_event *>(buffer + offset);
+                    offset += sizeof(inotify_event) + event->len;
+                    auto directory = _directories.find(event->wd);
+                    if (directory == _directories.end() || !event->len)
+                        continue;
+                    auto file = directory->second.files.find(event->name);
+                    if (file != directory->second.files.end()
+                        && std::find(changed.begin(), changed.end(), file->second) == changed.end())
+                        changed.push_back(file->second);
+                }
+            }
+        }
+#endif
+};
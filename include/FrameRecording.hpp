@@ -0,0 +1,113 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <stdexcept>
+
+#include "Matrix.hpp"
+
+/* State a frame was drawn with: everything else is fixed for a given obj and options */
+struct RecordedFrame {
+    float model[16];
+    float textureState;
+};
+
+/* Text log of a session, one line per input event and per drawn frame:
+ *   scop-recording 1
+ *   event <frame> <type> <key> <action> <x> <y>
+ *   frame <frame> <textureState> <16 model matrix values, column-major>
+ * Events are informative, replays only read the frames so they do not depend on timing. */
+class FrameRecorder {
+    public:
+        FrameRecorder(std::string const &path) : _file(path) {
+            if (!_file.is_open()) {
+                std::cerr << "Failed to open recording file: " << path << std::endl;
+                throw std::runtime_error("Failed to open recording file");
+            }
+            _file << "scop-recording 1\n" << std::setprecision(9);
+        }
+
+        void event(size_t frame, int type, int key, int action, double x, double y) {
+            _file << "event " << frame << ' ' << type << ' ' << key << ' ' << action << ' ' << x << ' ' << y << '\n';
+        }
+
+        void frame(size_t frame, Matrix const &model, float textureState) {
+            _file << "frame " << frame << ' ' << textureState;
+            for (int i = 0; i < 16; i++)
+                _file << ' ' << model.get_data()[i];
+            _file << '\n';
+        }
+
+        /* Frames of a recording, in order */
+        static std::vector<RecordedFrame> load(std::string const &path) {
+            std::ifstream file(path);
+            std::string line;
+            if (!file.is_open() || !std::getline(file, line) || line != "scop-recording 1") {
+                std::cerr << "Not a recording: " << path << std::endl;
+                throw std::runtime_error("Not a recording");
+            }
+
+            std::vector<RecordedFrame> frames;
+            size_t lineNb = 1;
+            while (std::getline(file, line)) {
+                lineNb++;
+                std::istringstream tokens(line);
+                std::string kind;
+                tokens >> kind;
+                if (kind != "frame")
+                    continue;
+                size_t index;
+                RecordedFrame frame;
+                tokens >> index >> frame.textureState;
+                for (float &value : frame.model)
+                    tokens >> value;
+                if (tokens.fail()) {
+                    std::cerr << "Invalid frame at line " << lineNb << " of " << path << std::endl;
+                    throw std::runtime_error("Invalid recording");
+                }
+                frames.push_back(frame);
+            }
+            if (frames.empty())
+                throw std::runtime_error("Recording has no frames");
+            return frames;
+        }
+
+    private:
+        std::ofstream _file;
+};
+
+/* Frame time statistics of a benchmark run */
+class FrameTimes {
+    public:
+        void add(double seconds) { _times.push_back(seconds * 1000.0); }
+
+        void report(std::ostream &os) const {
+            if (_times.empty())
+                return;
+            std::vector<double> sorted = _times;
+            std::sort(sorted.begin(), sorted.end());
+            double total = 0.0;
+            for (double time : sorted)
+                total += time;
+            double mean = total / sorted.size();
+            os << std::fixed << std::setprecision(3)
+                << "Frames: " << sorted.size() << ", " << sorted.size() * 1000.0 / total << " fps\n"
+                << "Frame time (ms): mean " << mean << ", median " << percentile(sorted, 0.5)
+                << ", p95 " << percentile(sorted, 0.95) << ", p99 " << percentile(sorted, 0.99)
+                << ", min " << sorted.front() << ", max " << sorted.back() << std::endl;
+            os.unsetf(std::ios::fixed);
+        }
+
+    private:
+        std::vector<double> _times; // Milliseconds
+
+        static double percentile(std::vector<double> const &sorted, double p) {
+            size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+            return sorted[std::min(index, sorted.size() - 1)];
+        }
+};
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstring>
+
+#include "Transform.hpp"
+#include "Shader.hpp"
+#include "StreamBuffer.hpp"
+
+/* std140 layout of the FrameData block shared by both shader stages */
+struct FrameData {
+    float model[16];
+    float view[16];
+    float projection[16];
+    float textureState;
+    float padding[3];
+};
+
+/* Per-frame uniforms streamed through a ring of uniform buffer regions instead of glUniform calls.
+ * Each frame writes the next region and binds it with glBindBufferRange; the region is fenced once
+ * the frame is submitted, so writing frame N + 3 is the first time the CPU can wait on frame N. */
+class FrameUniforms {
+    public:
+        FrameUniforms() : _buffer(GL_UNIFORM_BUFFER, sizeof(FrameData)) {}
+
+        void update(Transform const &transform, float textureState) {
+            auto *data = static_cast<FrameData *>(_buffer.begin());
+            std::memcpy(data->model, transform.modelMat.get_data(), sizeof(data->model));
+            std::memcpy(data->view, transform.viewMat.get_data(), sizeof(data->view));
+            std::memcpy(data->projection, transform.projectionMat.get_data(), sizeof(data->projection));
+            data->textureState = textureState;
+            size_t offset = _buffer.end(sizeof(FrameData));
+            glBindBufferRange(GL_UNIFORM_BUFFER, Shader::FRAME_DATA_BINDING, _buffer.getId(), offset, sizeof(FrameData));
+        }
+
+        /* Call once the draws of the frame are submitted */
+        void submitted() { _buffer.fence(); }
+
+        size_t getStalls() const { return _buffer.getStalls(); }
+
+    private:
+        StreamBuffer _buffer;
+};
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <cmath>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+#include "Matrix.hpp"
+
+/* View frustum planes extracted from a clip matrix (Gribb & Hartmann).
+ * Planes are stored as (a, b, c, d) with inward facing normalized normals. */
+class Frustum {
+    public:
+        enum { LEFT, RIGHT, BOTTOM, TOP, NEAR, FAR };
+        enum Visibility { OUTSIDE, INTERSECTING, INSIDE };
+
+        Frustum(Matrix const &clip) {
+            const float *m = clip.get_data();
+            /* Column-major storage: row i is (m[i], m[i + 4], m[i + 8], m[i + 12]) */
+            for (int axis = 0; axis < 3; axis++) {
+                for (int side = 0; side < 2; side++) {
+                    float sign = side == 0 ? 1.0f : -1.0f;
+                    auto &plane = _planes[axis * 2 + side];
+                    for (int k = 0; k < 4; k++)
+                        plane[k] = m[3 + k * 4] + sign * m[axis + k * 4];
+                    float length = std::sqrt(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+                    if (length > 0.0f)
+                        for (auto &value : plane)
+                            value /= length;
+                }
+            }
+
+            /* Center of projection: the point where clip x, y and w all vanish */
+            float a[3][3] = {{m[0], m[4], m[8]}, {m[1], m[5], m[9]}, {m[3], m[7], m[11]}};
+            float b[3] = {-m[12], -m[13], -m[15]};
+            float det = determinant(a);
+            _eye = {0.0f, 0.0f, 0.0f};
+            if (std::fabs(det) > 1e-12f) {
+                for (int col = 0; col < 3; col++) {
+                    float replaced[3][3];
+                    for (int row = 0; row < 3; row++)
+                        for (int k = 0; k < 3; k++)
+                            replaced[row][k] = k == col ? b[row] : a[row][k];
+                    _eye[col] = determinant(replaced) / det;
+                }
+            }
+
+            /* Structure of arrays copy padded to 8 planes with always-passing ones for the SIMD test */
+            for (size_t i = 0; i < 8; i++) {
+                _nx[i] = i < 6 ? _planes[i][0] : 0.0f;
+                _ny[i] = i < 6 ? _planes[i][1] : 0.0f;
+                _nz[i] = i < 6 ? _planes[i][2] : 0.0f;
+                _d[i] = i < 6 ? _planes[i][3] : 1.0f;
+            }
+        }
+
+        bool intersectsSphere(std::array<float, 3> const &center, float radius) const {
+            for (auto const &plane : _planes)
+                if (plane[0] * center[0] + plane[1] * center[1] + plane[2] * center[2] + plane[3] < -radius)
+                    return false;
+            return true;
+        }
+
+        /* Signed distance of the box center against its projected radius on each plane normal,
+         * four planes at a time when SSE is available */
+        Visibility classifyBox(std::array<float, 3> const &min, std::array<float, 3> const &max) const {
+            float cx = (min[0] + max[0]) * 0.5f, cy = (min[1] + max[1]) * 0.5f, cz = (min[2] + max[2]) * 0.5f;
+            float ex = (max[0] - min[0]) * 0.5f, ey = (max[1] - min[1]) * 0.5f, ez = (max[2] - min[2]) * 0.5f;
+#if defined(__SSE__)
+            const __m128 signMask = _mm_set1_ps(-0.0f);
+            const __m128 zero = _mm_setzero_ps();
+            int outside = 0, intersecting = 0;
+            for (size_t i = 0; i < 8; i += 4) {
+                __m128 nx = _mm_load_ps(_nx + i), ny = _mm_load_ps(_ny + i), nz = _mm_load_ps(_nz + i);
+                __m128 dist = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(nx, _mm_set1_ps(cx)), _mm_mul_ps(ny, _mm_set1_ps(cy))),
+                    _mm_add_ps(_mm_mul_ps(nz, _mm_set1_ps(cz)), _mm_load_ps(_d + i)));
+                __m128 radius = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(_mm_andnot_ps(signMask, nx), _mm_set1_ps(ex)), _mm_mul_ps(_mm_andnot_ps(signMask, ny), _mm_set1_ps(ey))),
+                    _mm_mul_ps(_mm_andnot_ps(signMask, nz), _mm_set1_ps(ez)));
+                outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(dist, radius), zero));
+                intersecting |= _mm_movemask_ps(_mm_cmplt_ps(_mm_sub_ps(dist, radius), zero));
+            }
+            if (outside)
+                return OUTSIDE;
+            return intersecting ? INTERSECTING : INSIDE;
+#else
+            Visibility result = INSIDE;
+            for (size_t i = 0; i < 6; i++) {
+                float dist = _nx[i] * cx + _ny[i] * cy + _nz[i] * cz + _d[i];
+                float radius = std::fabs(_nx[i]) * ex + std::fabs(_ny[i]) * ey + std::fabs(_nz[i]) * ez;
+                if (dist + radius < 0.0f)
+                    return OUTSIDE;
+                if (dist - radius < 0.0f)
+                    result = INTERSECTING;
+            }
+            return result;
+#endif
+        }
+
+        std::array<std::array<float, 4>, 6> const &getPlanes() const { return _planes; }
+        std::array<float, 3> const &getEye() const { return _eye; }
+
+    private:
+        std::array<std::array<float, 4>, 6> _planes;
+        std::array<float, 3> _eye;
+        alignas(16) float _nx[8], _ny[8], _nz[8], _d[8];
+
+        static float determinant(float const (&m)[3][3]) {
+            return m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1])
+                - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0])
+                + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+        }
+};
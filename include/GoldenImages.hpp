@@ -0,0 +1,277 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <filesystem>
+#include <functional>
+#include <algorithm>
+#include <array>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include "App.hpp"
+#include "BMP.hpp"
+#include "Options.hpp"
+#include "Parser.hpp"
+
+/* Regression check of the rendered output: every asset is drawn offscreen from fixed cameras and
+ * compared with the reference images stored in the golden directory, failing below a PSNR
+ * threshold. The PSNR only counts the pixels where either image differs from the clear color, so
+ * the background does not dilute the error of small meshes. Optimizations that are meant to keep
+ * the image (quantization, reordering, levels of detail, culling) must keep passing; references
+ * are regenerated with --update-golden when the output changes on purpose. Only needs a GL 4.1
+ * context, Mesa's llvmpipe is enough and rendered the references in assets/golden:
+ *   LIBGL_ALWAYS_SOFTWARE=1 xvfb-run make golden-update
+ *
+ * The default threshold of 40 dB comes from measurements on llvmpipe. Repeated renders of the
+ * same build score above 85 dB: texture pages are placed in load completion order, which can
+ * move a filtered texel by one level. Every option that changes the output scores below 35 dB:
+ * --lod-error 0 to 8 instead of the default 1 gives 13 to 25 dB, --cone-culling gives 16.6 dB on
+ * the open teapots and 34.8 dB on face, where it drops a few visible meshlets. Since only covered
+ * pixels count, one flipped edge pixel costs more on a small mesh: 40 dB is one pixel fully off
+ * among about 10000. Assets whose smallest view covers fewer pixels get that one-pixel value,
+ * rounded down, in thresholds.txt next to the references ("<asset> <dB>" lines); the others use
+ * --golden-psnr. */
+class GoldenImages {
+    public:
+        static constexpr int IMAGE_WIDTH = 400;
+        static constexpr int IMAGE_HEIGHT = 300;
+        static constexpr int MAX_WARMUP_FRAMES = 256; // Frames drawn at most while textures stream in
+
+        GoldenImages(App &app, std::function<void()> render, Options const &options)
+            : _app(app), _render(std::move(render)), _options(options) {
+            glGenFramebuffers(1, &_fbo);
+            glGenRenderbuffers(2, _renderbuffers);
+            glBindRenderbuffer(GL_RENDERBUFFER, _renderbuffers[0]);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, IMAGE_WIDTH, IMAGE_HEIGHT);
+            glBindRenderbuffer(GL_RENDERBUFFER, _renderbuffers[1]);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, IMAGE_WIDTH, IMAGE_HEIGHT);
+            glBindRenderbuffer(GL_RENDERBUFFER, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, _renderbuffers[0]);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, _renderbuffers[1]);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                std::cerr << "Incomplete offscreen framebuffer" << std::endl;
+                throw std::runtime_error("Incomplete offscreen framebuffer");
+            }
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+        ~GoldenImages() {
+            glDeleteFramebuffers(1, &_fbo);
+            glDeleteRenderbuffers(2, _renderbuffers);
+        }
+        GoldenImages(GoldenImages const &) = delete;
+        GoldenImages &operator=(GoldenImages const &) = delete;
+
+        /* The obj files to check: the file itself, or every obj of a directory in name order */
+        static std::vector<std::string> listAssets(std::string const &path) {
+            namespace fs = std::filesystem;
+            std::vector<std::string> assets;
+            if (!fs::is_directory(path))
+                return {path};
+            for (auto const &entry : fs::directory_iterator(path))
+                if (entry.is_regular_file() && entry.path().extension() == ".obj")
+                    assets.push_back(entry.path().string());
+            std::sort(assets.begin(), assets.end());
+            return assets;
+        }
+
+        /* Render every view of every asset, the first one being the mesh the app was created with.
+         * Returns true when every image matches its reference, or when the references were written. */
+        bool run(std::vector<std::string> const &assets) {
+            std::filesystem::create_directories(_options.goldenDirectory);
+            loadThresholds();
+            size_t failures = 0, images = 0;
+            for (size_t i = 0; i < assets.size(); i++) {
+                std::unique_ptr<Parser> parser;
+                if (i > 0) {
+                    try {
+                        parser = std::make_unique<Parser>(assets[i], _options.texturePath);
+                        _app.reloadMesh(parser->getObjects());
+                    } catch (std::exception const &e) {
+                        std::cerr << assets[i] << ": " << e.what() << std::endl;
+                        failures++;
+                        continue;
+                    }
+                }
+
+                std::string stem = std::filesystem::path(assets[i]).stem().string();
+                auto threshold = _thresholds.find(stem);
+                double minimum = threshold != _thresholds.end() ? threshold->second : _options.goldenPsnr;
+                for (auto const &view : VIEWS) {
+                    std::string name = stem + "_" + view.name;
+                    double milliseconds = 0.0;
+                    BMP image = render(view, milliseconds);
+                    images++;
+                    if (!check(name, image, milliseconds, minimum))
+                        failures++;
+                }
+                /* The materials of the mesh live in its parser */
+                _parser = std::move(parser);
+            }
+
+            std::cout << images << " images, " << failures << " failures" << std::endl;
+            return failures == 0;
+        }
+
+    private:
+        struct View {
+            const char *name;
+            float pitch, yaw; // Radians
+        };
+        static constexpr View VIEWS[] = {
+            {"front", 0.0f, 0.0f},
+            {"side", 0.0f, 1.5707963f},
+            {"back", 0.0f, 3.1415927f},
+            {"top", 1.5707963f, 0.0f},
+            {"angle", 0.5f, 0.8f}
+        };
+
+        App &_app;
+        std::function<void()> _render;
+        Options const &_options;
+        std::unique_ptr<Parser> _parser;
+        std::map<std::string, double> _thresholds; // Lowest PSNR per asset stem, from thresholds.txt
+        GLuint _fbo = 0;
+        GLuint _renderbuffers[2] = {0, 0}; // Color, depth
+        std::array<unsigned char, 3> _background = {0, 0, 0}; // Clear color of the last render
+
+        /* Optional <golden dir>/thresholds.txt: "<asset> <dB>" per line, # starts a comment */
+        void loadThresholds() {
+            _thresholds.clear();
+            std::ifstream file(_options.goldenDirectory + "/thresholds.txt");
+            std::string line;
+            for (size_t lineNb = 1; std::getline(file, line); lineNb++) {
+                line = line.substr(0, line.find('#'));
+                std::istringstream stream(line);
+                std::string asset;
+                double minimum;
+                if (!(stream >> asset))
+                    continue;
+                if (!(stream >> minimum) || !(stream >> std::ws).eof()) {
+                    std::cerr << "Invalid golden threshold on line " << lineNb << ", expected <asset> <dB>" << std::endl;
+                    throw std::runtime_error("Invalid golden thresholds");
+                }
+                _thresholds[asset] = minimum;
+            }
+        }
+
+        /* The mesh is centered on the origin: back the camera off until its bounding sphere fits */
+        BMP render(View const &view, double &milliseconds) {
+            _app._transform = std::make_unique<Transform>(WIDTH, HEIGHT);
+            Matrix &model = _app._transform->modelMat;
+            model.rotate(view.yaw, 0.0f, 1.0f, 0.0f);
+            model.rotate(view.pitch, 1.0f, 0.0f, 0.0f);
+            float radius = std::max(_app._mesh->getBoundingRadius(), 0.01f);
+            model.move(0.0f, 0.0f, -radius / std::sin(_app._transform->fov * 0.5f * static_cast<float>(M_PI) / 180.0f));
+            _app.textureState = _app.renderTextureState = 0.0f;
+            _app.isInTransition = false;
+
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            glBindFramebuffer(GL_FRAMEBUFFER, _fbo);
+            glViewport(0, 0, IMAGE_WIDTH, IMAGE_HEIGHT);
+
+            /* Draw until every texture is resident so the image does not depend on streaming */
+            for (int frame = 0; frame < MAX_WARMUP_FRAMES; frame++) {
+                _app.drawFrame(_render);
+                if (!_app.isStreamingTextures())
+                    break;
+            }
+            glFinish();
+            auto start = std::chrono::steady_clock::now();
+            _app.drawFrame(_render);
+            glFinish();
+            milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+            GLfloat clearColor[4];
+            glGetFloatv(GL_COLOR_CLEAR_VALUE, clearColor);
+            for (int k = 0; k < 3; k++)
+                _background[k] = static_cast<unsigned char>(std::lround(std::clamp(clearColor[k], 0.0f, 1.0f) * 255.0f));
+
+            BMP image;
+            image.width = IMAGE_WIDTH;
+            image.height = IMAGE_HEIGHT;
+            image.data.resize(static_cast<size_t>(IMAGE_WIDTH) * IMAGE_HEIGHT * 3);
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, _fbo);
+            glPixelStorei(GL_PACK_ALIGNMENT, 1);
+            glReadPixels(0, 0, IMAGE_WIDTH, IMAGE_HEIGHT, GL_RGB, GL_UNSIGNED_BYTE, image.data.data());
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+            return image;
+        }
+
+        /* Compare with the reference, or replace it with --update-golden. Failed renders are kept
+         * next to the reference as <name>_actual.bmp. */
+        bool check(std::string const &name, BMP const &image, double milliseconds, double minimum) {
+            std::string path = _options.goldenDirectory + "/" + name + ".bmp";
+            std::cout << std::left << std::setw(20) << name << std::right << std::fixed << std::setprecision(2)
+                << std::setw(8) << milliseconds << " ms  ";
+
+            if (_options.updateGolden) {
+                bool written = image.write(path);
+                std::filesystem::remove(_options.goldenDirectory + "/" + name + "_actual.bmp");
+                std::cout << (written ? "written" : "FAILED to write " + path) << std::endl;
+                std::cout.unsetf(std::ios::fixed);
+                return written;
+            }
+
+            bool passed = false;
+            unsigned width, height;
+            if (!Parser::readTextureSize(path, width, height)) {
+                std::cout << "FAILED, no reference (run with --update-golden)";
+            } else {
+                BMP reference = Parser::readTexture(path);
+                if (reference.width != image.width || reference.height != image.height) {
+                    std::cout << "FAILED, reference is " << reference.width << "x" << reference.height;
+                } else {
+                    double value = psnr(image, reference, _background);
+                    passed = value >= minimum;
+                    std::cout << (passed ? "ok" : "FAILED") << ", PSNR ";
+                    if (std::isinf(value))
+                        std::cout << "inf";
+                    else
+                        std::cout << value << " dB";
+                    if (!passed)
+                        std::cout << " < " << minimum << " dB";
+                }
+            }
+            std::cout << std::endl;
+            std::cout.unsetf(std::ios::fixed);
+            if (!passed)
+                image.write(_options.goldenDirectory + "/" + name + "_actual.bmp");
+            return passed;
+        }
+
+        /* Peak signal to noise ratio over the RGB channels of the pixels where either image is not the
+         * background, infinite for identical images */
+        static double psnr(BMP const &a, BMP const &b, std::array<unsigned char, 3> const &background) {
+            auto isBackground = [&background](BMP const &image, size_t pixel) {
+                return std::equal(background.begin(), background.end(), image.data.begin() + pixel);
+            };
+            double squaredError = 0.0;
+            size_t samples = 0;
+            for (size_t i = 0; i + 2 < a.data.size(); i += 3) {
+                if (isBackground(a, i) && isBackground(b, i))
+                    continue;
+                for (size_t k = i; k < i + 3; k++) {
+                    double difference = static_cast<double>(a.data[k]) - b.data[k];
+                    squaredError += difference * difference;
+                }
+                samples += 3;
+            }
+            if (squaredError == 0.0)
+                return std::numeric_limits<double>::infinity();
+            double mse = squaredError / samples;
+            return 10.0 * std::log10(255.0 * 255.0 / mse);
+        }
+};
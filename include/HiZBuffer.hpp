@@ -0,0 +1,117 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <cmath>
+#include <algorithm>
+#include <utility>
+
+#include "Matrix.hpp"
+#include "BVH.hpp"
+
+/* Hierarchical depth pyramid: every level keeps the farthest depth of the 2x2 texels below it,
+ * so a box whose nearest depth is behind every texel its screen rect covers is hidden. The rect
+ * is tested at the level where it spans at most a few texels, whatever its size on screen.
+ * Depth is window depth (0 near, 1 far) with row 0 at the bottom, as read back from GL. The
+ * boxes are projected with the clip matrix the depth was rendered with. A texel may stand for
+ * several viewport pixels, `extent` being the size of the viewport in texels. */
+class HiZBuffer {
+    public:
+        /* Nearest points in front of the occluders by less than this are kept, depth is not exact */
+        static constexpr float DEPTH_BIAS = 1e-4f;
+
+        void build(std::vector<float> depth, int width, int height, Matrix const &clip) {
+            build(std::move(depth), width, height, clip, {static_cast<float>(width), static_cast<float>(height)});
+        }
+        void build(std::vector<float> depth, int width, int height, Matrix const &clip, std::array<float, 2> extent) {
+            _clip = clip;
+            _extent = extent;
+            _levels.clear();
+            _sizes.clear();
+            _levels.push_back(std::move(depth));
+            _sizes.push_back({width, height});
+            while (width > 1 || height > 1) {
+                int nextWidth = std::max(1, (width + 1) / 2), nextHeight = std::max(1, (height + 1) / 2);
+                std::vector<float> const &below = _levels.back();
+                std::vector<float> level(static_cast<size_t>(nextWidth) * nextHeight);
+                for (int y = 0; y < nextHeight; y++) {
+                    int y0 = y * 2, y1 = std::min(y * 2 + 1, height - 1);
+                    for (int x = 0; x < nextWidth; x++) {
+                        int x0 = x * 2, x1 = std::min(x * 2 + 1, width - 1);
+                        level[y * nextWidth + x] = std::max(
+                            std::max(below[y0 * width + x0], below[y0 * width + x1]),
+                            std::max(below[y1 * width + x0], below[y1 * width + x1]));
+                    }
+                }
+                _levels.push_back(std::move(level));
+                _sizes.push_back({nextWidth, nextHeight});
+                width = nextWidth;
+                height = nextHeight;
+            }
+        }
+
+        bool isValid() const { return !_levels.empty(); }
+        Matrix const &getClip() const { return _clip; }
+
+        /* True only when the whole box is behind the depth; boxes crossing the near plane are never hidden */
+        bool isOccluded(AABB const &box) const {
+            if (_levels.empty() || !box.isValid())
+                return false;
+
+            const float *m = _clip.get_data();
+            float minX = 1.0f, minY = 1.0f, maxX = -1.0f, maxY = -1.0f, minZ = 1.0f;
+            for (int corner = 0; corner < 8; corner++) {
+                float p[3] = {
+                    corner & 1 ? box.max[0] : box.min[0],
+                    corner & 2 ? box.max[1] : box.min[1],
+                    corner & 4 ? box.max[2] : box.min[2]
+                };
+                float clip[4];
+                for (int row = 0; row < 4; row++)
+                    clip[row] = m[row] * p[0] + m[row + 4] * p[1] + m[row + 8] * p[2] + m[row + 12];
+                if (clip[3] <= 1e-5f || clip[2] < -clip[3])
+                    return false;
+                float x = clip[0] / clip[3], y = clip[1] / clip[3];
+                minX = std::min(minX, x);
+                maxX = std::max(maxX, x);
+                minY = std::min(minY, y);
+                maxY = std::max(maxY, y);
+                minZ = std::min(minZ, clip[2] / clip[3]);
+            }
+            minX = std::max(minX, -1.0f);
+            minY = std::max(minY, -1.0f);
+            maxX = std::min(maxX, 1.0f);
+            maxY = std::min(maxY, 1.0f);
+            if (minX > maxX || minY > maxY)
+                return false;
+
+            float x0 = (minX * 0.5f + 0.5f) * _extent[0], x1 = (maxX * 0.5f + 0.5f) * _extent[0];
+            float y0 = (minY * 0.5f + 0.5f) * _extent[1], y1 = (maxY * 0.5f + 0.5f) * _extent[1];
+            float extent = std::max(std::max(x1 - x0, y1 - y0), 1.0f);
+            size_t level = std::min(static_cast<size_t>(std::ceil(std::log2(extent))), _levels.size() - 1);
+
+            auto const &size = _sizes[level];
+            int tx0 = std::clamp(static_cast<int>(x0) >> level, 0, size[0] - 1);
+            int tx1 = std::clamp(static_cast<int>(x1) >> level, 0, size[0] - 1);
+            int ty0 = std::clamp(static_cast<int>(y0) >> level, 0, size[1] - 1);
+            int ty1 = std::clamp(static_cast<int>(y1) >> level, 0, size[1] - 1);
+            float farthest = 0.0f;
+            for (int y = ty0; y <= ty1; y++)
+                for (int x = tx0; x <= tx1; x++)
+                    farthest = std::max(farthest, _levels[level][y * size[0] + x]);
+            return minZ * 0.5f + 0.5f > farthest + DEPTH_BIAS;
+        }
+
+        bool isOccluded(std::array<float, 3> const &center, float radius) const {
+            AABB box;
+            box.expand(center[0] - radius, center[1] - radius, center[2] - radius);
+            box.expand(center[0] + radius, center[1] + radius, center[2] + radius);
+            return isOccluded(box);
+        }
+
+    private:
+        Matrix _clip;
+        std::array<float, 2> _extent = {0.0f, 0.0f};
+        std::vector<std::vector<float>> _levels;
+        std::vector<std::array<int, 2>> _sizes;
+};
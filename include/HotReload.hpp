@@ -0,0 +1,241 @@
+#pragma once
+
+#include <iostream>
+#include <memory>
+#include <chrono>
+#include <unordered_map>
+#include <algorithm>
+#include <utility>
+
+#include "FileWatcher.hpp"
+#include "JobSystem.hpp"
+#include "Parser.hpp"
+#include "Shader.hpp"
+#include "App.hpp"
+
+/* Loads obj files dropped on the window and, with --watch, watches the obj, its material libraries,
+ * the texture and the shaders, reloading only what changed:
+ * - shaders: the program is rebuilt, a source that does not compile keeps the previous program
+ * - texture: the image is decoded by the job system and repacked into the texture array
+ * - mtl: values are copied over the existing materials, geometry is untouched
+ * - obj: the file is parsed by the job system and objects are compared by fingerprint; the mesh
+ *   is only rebuilt, still on the worker, when one of them actually changed, and only the changed
+ *   ranges of its buffers are uploaded; a dropped obj is loaded the same way and replaces the
+ *   watched one
+ * Only the GL uploads run on the render thread. Any failure leaves the previous state in place. */
+class HotReload {
+    public:
+        HotReload(std::string const &objPath, std::string const &texturePath, App &app, std::unique_ptr<Parser> &parser, Shader &shader, bool watch)
+            : _objPath(objPath), _requestedPath(objPath), _texturePath(texturePath), _app(app), _parser(parser), _shader(shader), _watch(watch) {
+            _fingerprints = fingerprints(*_parser);
+            if (!_watch)
+                return;
+            _watcher.watch(_objPath);
+            _watcher.watch(_texturePath);
+            _watcher.watch(_shader.getVertexPath());
+            _watcher.watch(_shader.getFragmentPath());
+            for (auto const &path : _parser->getMaterialLibraryPaths())
+                _watcher.watch(path);
+        }
+
+        /* Start reloads for the changed files and apply the finished ones, called once per frame
+         * on the render thread. Returns true if anything was applied */
+        bool poll() {
+            bool applied = finishObj() | finishTexture();
+            std::string dropped = _app.takeDroppedPath();
+            if (!dropped.empty())
+                open(dropped);
+
+            auto changed = _watcher.poll();
+            if (changed.empty())
+                return applied;
+
+            bool shaders = false, obj = false;
+            for (auto const &path : changed) {
+                if (path == _shader.getVertexPath() || path == _shader.getFragmentPath())
+                    shaders = true;
+                else if (path == _objPath)
+                    obj = true;
+                else if (path == _texturePath)
+                    startTexture();
+                else if (!obj && isMaterialLibrary(path)) {
+                    auto start = std::chrono::steady_clock::now();
+                    if (!reloadMaterials(path))
+                        obj = true;
+                    report(path, start);
+                }
+            }
+
+            if (obj)
+                startObj();
+            if (shaders) {
+                auto start = std::chrono::steady_clock::now();
+                if (!_shader.reload())
+                    std::cerr << "Shader reload failed, keeping the previous program" << std::endl;
+                else
+                    _app.reloadDepthPrepass();
+                report("shaders", start);
+            }
+            return true;
+        }
+
+        /* Load another obj in place of the current one, which stays on screen, and watched, until the
+         * new one is ready */
+        void open(std::string const &path) {
+            std::cout << "Loading " << path << std::endl;
+            _requestedPath = path;
+            startObj();
+        }
+
+    private:
+        /* Result of an obj reload prepared on a worker thread, mesh is null when nothing changed */
+        struct LoadedObj {
+            std::string path;
+            std::unique_ptr<Parser> parser;
+            std::unique_ptr<Mesh> mesh;
+            std::unordered_map<std::string, size_t> fingerprints;
+        };
+
+        FileWatcher _watcher;
+        std::string _objPath;       // Obj of the current mesh
+        std::string _requestedPath; // Obj to load next, differs from _objPath while a dropped file loads
+        std::string _texturePath;
+        App &_app;
+        std::unique_ptr<Parser> &_parser;
+        Shader &_shader;
+        bool _watch;
+        std::unordered_map<std::string, size_t> _fingerprints;
+
+        /* Jobs in flight, they write their result to the shared object so nothing waits on them */
+        JobSystem::Handle _objJob, _textureJob;
+        std::shared_ptr<LoadedObj> _loadedObj;
+        std::shared_ptr<BMP> _loadedTexture;
+        std::chrono::steady_clock::time_point _objStart, _textureStart;
+        bool _objAgain = false, _textureAgain = false; // Changed again while being loaded
+
+        static std::unordered_map<std::string, size_t> fingerprints(Parser const &parser) {
+            std::unordered_map<std::string, size_t> result;
+            for (auto const &object : parser.getObjects())
+                result[object.first] = object.second.fingerprint();
+            return result;
+        }
+
+        /* Files of a previously loaded obj stay watched, their changes are ignored */
+        bool isMaterialLibrary(std::string const &path) const {
+            auto const &libraries = _parser->getMaterialLibraryPaths();
+            return std::find(libraries.begin(), libraries.end(), path) != libraries.end();
+        }
+
+        static bool isReady(JobSystem::Handle const &job) {
+            return job && JobSystem::isDone(job);
+        }
+
+        void startTexture() {
+            if (_textureJob) {
+                _textureAgain = true;
+                return;
+            }
+            _textureStart = std::chrono::steady_clock::now();
+            auto texture = _loadedTexture = std::make_shared<BMP>();
+            _textureJob = JobSystem::instance().submitBackground(
+                [texture, path = _texturePath]() { *texture = Parser::readTexture(path); });
+        }
+
+        bool finishTexture() {
+            if (!isReady(_textureJob))
+                return false;
+            try {
+                /* Returns at once, rethrowing the exception of a failed load */
+                JobSystem::instance().wait(std::exchange(_textureJob, nullptr));
+                _parser->getTexture() = std::move(*_loadedTexture);
+                _app.setTexture(_parser->getTexture());
+                report(_texturePath, _textureStart);
+            } catch (std::exception const &e) {
+                std::cerr << "Texture reload failed: " << e.what() << std::endl;
+            }
+            if (_textureAgain) {
+                _textureAgain = false;
+                startTexture();
+            }
+            return true;
+        }
+
+        /* Returns false when the library no longer matches the materials the mesh refers to */
+        bool reloadMaterials(std::string const &path) {
+            try {
+                if (!_parser->reloadMaterialLibrary(path))
+                    return false;
+                _app.updateMaterials();
+                return true;
+            } catch (std::exception const &) {
+                std::cerr << "Material library reload failed: " << path << std::endl;
+                return true;
+            }
+        }
+
+        void startObj() {
+            if (_objJob) {
+                _objAgain = true;
+                return;
+            }
+            _objStart = std::chrono::steady_clock::now();
+            auto loaded = _loadedObj = std::make_shared<LoadedObj>();
+            loaded->path = _requestedPath;
+            _objJob = JobSystem::instance().submitBackground(
+                [loaded, path = _requestedPath, previous = _fingerprints, libraries = _parser->getMaterialLibraryPaths()]() {
+                    loaded->parser = std::make_unique<Parser>(path);
+                    if (loaded->parser->getObjects().empty())
+                        throw std::runtime_error("No object found in reloaded file");
+                    loaded->fingerprints = fingerprints(*loaded->parser);
+                    if (loaded->fingerprints != previous || loaded->parser->getMaterialLibraryPaths() != libraries)
+                        loaded->mesh = std::make_unique<Mesh>(loaded->parser->getObjects());
+                });
+        }
+
+        bool finishObj() {
+            if (!isReady(_objJob))
+                return false;
+            bool applied = false;
+            std::string path = _loadedObj->path;
+            try {
+                JobSystem::instance().wait(std::exchange(_objJob, nullptr));
+                LoadedObj loaded = std::move(*_loadedObj);
+                _loadedObj = nullptr;
+                if (path != _objPath) {
+                    _objPath = path;
+                    if (_watch)
+                        _watcher.watch(_objPath);
+                }
+                if (!loaded.mesh)
+                    std::cout << "Obj saved without changes, mesh kept" << std::endl;
+                else {
+                    /* The mesh points to the materials of the new parser, the old one goes away with the old mesh */
+                    _app.setMesh(std::move(loaded.mesh));
+                    loaded.parser->getTexture() = std::move(_parser->getTexture());
+                    _parser = std::move(loaded.parser);
+                    _fingerprints = std::move(loaded.fingerprints);
+                    if (_watch)
+                        for (auto const &path : _parser->getMaterialLibraryPaths())
+                            _watcher.watch(path);
+                    applied = true;
+                    report(_objPath, _objStart);
+                }
+            } catch (std::exception const &e) {
+                std::cerr << "Failed to load " << path << ", keeping the previous mesh: " << e.what() << std::endl;
+                /* Later changes reload the file of the mesh on screen, unless another one was requested meanwhile */
+                _loadedObj = nullptr;
+                if (_requestedPath == path)
+                    _requestedPath = _objPath;
+            }
+            if (_objAgain) {
+                _objAgain = false;
+                startObj();
+            }
+            return applied;
+        }
+
+        static void report(std::string const &what, std::chrono::steady_clock::time_point start) {
+            auto elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "Reloaded " << what << " in " << elapsed << " ms" << std::endl;
+        }
+};
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+#include <array>
+#include <cmath>
+#include <algorithm>
+
+#include "Matrix.hpp"
+#include "Frustum.hpp"
+#include "Transform.hpp"
+#include "StreamBuffer.hpp"
+
+/* Transforms of the copies of a mesh drawn with hardware instancing.
+ * Every frame the instances are culled on the CPU against the view frustum and the visible
+ * transforms are streamed into a texture buffer read by the vertex shader with gl_InstanceID. */
+class InstanceSet {
+    public:
+        InstanceSet(std::vector<Matrix> const &transforms)
+            : _transforms(transforms), _buffer(GL_TEXTURE_BUFFER, std::max<size_t>(transforms.size(), 1) * sizeof(float) * 16) {
+            glGenTextures(1, &_texture);
+            glBindTexture(GL_TEXTURE_BUFFER, _texture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, _buffer.getId());
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+            std::cout << "Instance set created with " << _transforms.size() << " instances ("
+                << (_buffer.isPersistent() ? "persistent mapping" : "buffer updates") << ")" << std::endl;
+        }
+        ~InstanceSet() { glDeleteTextures(1, &_texture); }
+
+        /* Square grid on the XY plane, pushed back so the whole grid fits in the default view */
+        static std::vector<Matrix> grid(size_t count, float spacing) {
+            std::vector<Matrix> transforms(count);
+            size_t side = static_cast<size_t>(std::ceil(std::sqrt(static_cast<float>(count))));
+            float half = (side - 1) * spacing * 0.5f;
+            for (size_t i = 0; i < count; i++) {
+                transforms[i].move((i % side) * spacing - half, (i / side) * spacing - half, -(half * 2.0f + spacing) * 1.5f);
+            }
+            return transforms;
+        }
+
+        /* Keep the instances whose bounding sphere intersects the frustum and stream them to the GPU */
+        void cull(Transform const &transform, std::array<float, 3> const &center, float radius) {
+            Frustum frustum(transform.projectionMat * transform.viewMat);
+            float *out = static_cast<float *>(_buffer.begin());
+
+            _visibleCount = 0;
+            for (auto const &instance : _transforms) {
+                Matrix world = transform.modelMat * instance;
+                const float *m = world.get_data();
+
+                std::array<float, 3> worldCenter;
+                for (int row = 0; row < 3; row++)
+                    worldCenter[row] = m[row] * center[0] + m[row + 4] * center[1] + m[row + 8] * center[2] + m[row + 12];
+
+                float scale = 0.0f;
+                for (int col = 0; col < 3; col++)
+                    scale = std::max(scale, m[col * 4] * m[col * 4] + m[col * 4 + 1] * m[col * 4 + 1] + m[col * 4 + 2] * m[col * 4 + 2]);
+
+                if (!frustum.intersectsSphere(worldCenter, radius * std::sqrt(scale)))
+                    continue;
+                std::copy(instance.get_data(), instance.get_data() + 16, out + _visibleCount * 16);
+                _visibleCount++;
+            }
+
+            _offset = _buffer.end(_visibleCount * sizeof(float) * 16);
+        }
+
+        /* Bind the visible transforms for a Shader::INSTANCED program, returns the number of instances to draw */
+        GLsizei bind(GLuint programId, GLuint unit) const {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(GL_TEXTURE_BUFFER, _texture);
+            glUniform1i(glGetUniformLocation(programId, "instanceData"), unit);
+            glUniform1i(glGetUniformLocation(programId, "instanceOffset"), static_cast<GLint>(_offset / (sizeof(float) * 4)));
+            glActiveTexture(GL_TEXTURE0);
+            return static_cast<GLsizei>(_visibleCount);
+        }
+
+        /* Call after the instanced draw so the region is not overwritten while in flight */
+        void submitted() { _buffer.fence(); }
+
+        size_t getCount() const { return _transforms.size(); }
+        size_t getVisibleCount() const { return _visibleCount; }
+        std::vector<Matrix> &getTransforms() { return _transforms; }
+
+    private:
+        std::vector<Matrix> _transforms;
+        StreamBuffer _buffer;
+        GLuint _texture = 0;
+        size_t _visibleCount = 0;
+        size_t _offset = 0;
+};
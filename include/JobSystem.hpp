@@ -0,0 +1,289 @@
+#pragma once
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <exception>
+#include <iostream>
+#include <algorithm>
+#include <string>
+#include <cstdint>
+
+/* Work-stealing scheduler shared by every CPU processing stage.
+ * Each worker owns a deque: it pushes and pops its own jobs at the back, while idle workers steal
+ * from the front of the others. Threads outside the pool submit to a shared injection queue.
+ * A job may depend on other jobs and is only queued once they have all completed.
+ * wait() runs queued jobs while the awaited one is unfinished, so waiting from inside a job cannot
+ * deadlock. A thread outside the pool only helps with the injection queue: the jobs it waits for
+ * are its own or their dependents, and it never picks up a whole chunk of another worker's deque.
+ * Long jobs that nobody waits on, such as asset loads started from the render thread, go through
+ * submitBackground() to a queue that only the workers drain, so a frame waiting on its culling jobs
+ * cannot end up parsing an obj file. The pool keeps at least one worker so that these jobs, polled
+ * with isDone(), also progress on a single core. */
+class JobSystem {
+    public:
+        struct Job {
+            std::function<void()> work;
+            bool background = false;
+            std::atomic<size_t> pendingDependencies{1}; // The extra one is released once submit() is done
+            bool done = false;
+            std::exception_ptr error;
+            std::vector<std::shared_ptr<Job>> dependents;
+            std::mutex mutex;
+        };
+        using Handle = std::shared_ptr<Job>;
+
+        static JobSystem &instance() {
+            static JobSystem system;
+            return system;
+        }
+
+        ~JobSystem() {
+            _running = false;
+            notify();
+            for (auto &thread : _threads)
+                thread.join();
+        }
+
+        JobSystem(JobSystem const &) = delete;
+        JobSystem &operator=(JobSystem const &) = delete;
+
+        /* Queue `work` once every job in `dependencies` has completed, failed ones included */
+        Handle submit(std::function<void()> work, std::vector<Handle> const &dependencies = {}) {
+            return submit(std::move(work), dependencies, false);
+        }
+
+        /* Queue `work` for the workers only, for jobs polled with isDone() rather than waited for */
+        Handle submitBackground(std::function<void()> work) {
+            return submit(std::move(work), {}, true);
+        }
+
+        /* Run queued jobs until `job` has completed, then rethrow its exception if it failed */
+        void wait(Handle const &job) {
+            while (!isDone(job)) {
+                if (runOne())
+                    continue;
+                std::unique_lock<std::mutex> lock(_sleepMutex);
+                _sleep.wait(lock, [&]() { return isDone(job) || hasRunnable(); });
+            }
+            if (job->error)
+                std::rethrow_exception(job->error);
+        }
+
+        /* Non-blocking completion check, for callers polling once per frame; wait() then returns at once
+         * and rethrows the job's exception if it failed */
+        static bool isDone(Handle const &job) {
+            std::lock_guard<std::mutex> lock(job->mutex);
+            return job->done;
+        }
+
+        /* Wait for every job before rethrowing the first failure, the jobs may refer to the caller's stack */
+        void waitAll(std::vector<Handle> const &jobs) {
+            std::exception_ptr error;
+            for (auto const &job : jobs) {
+                try {
+                    wait(job);
+                } catch (...) {
+                    if (!error)
+                        error = std::current_exception();
+                }
+            }
+            if (error)
+                std::rethrow_exception(error);
+        }
+
+        /* Split [0, count) in chunks of at least `grain` items, call body(first, last) on each and wait */
+        template <typename Body>
+        void parallelFor(size_t count, size_t grain, Body const &body) {
+            size_t chunks = std::min((count + grain - 1) / std::max<size_t>(grain, 1), getThreadCount() * CHUNKS_PER_THREAD);
+            if (chunks <= 1) {
+                body(size_t(0), count);
+                return;
+            }
+            std::vector<Handle> jobs;
+            size_t chunk = (count + chunks - 1) / chunks;
+            for (size_t first = 0; first < count; first += chunk) {
+                size_t last = std::min(count, first + chunk);
+                jobs.push_back(submit([&body, first, last]() { body(first, last); }));
+            }
+            waitAll(jobs);
+        }
+
+        /* Pool workers plus the calling thread, which always helps while waiting */
+        size_t getThreadCount() const { return _threads.size() + 1; }
+
+        /* Jobs run since the last report and the share of the elapsed time the threads spent in them */
+        void report(std::string const &label) {
+            auto now = std::chrono::steady_clock::now();
+            double elapsed = std::chrono::duration<double, std::nano>(now - _lastReport).count();
+            _lastReport = now;
+            size_t jobs = 0;
+            double busy = 0.0;
+            for (size_t i = 0; i <= _threads.size(); i++) {
+                jobs += _stats[i].jobs.exchange(0);
+                busy += static_cast<double>(_stats[i].busyNanoseconds.exchange(0));
+            }
+            std::cout << label << ": " << jobs << " jobs on " << getThreadCount() << " threads, "
+                << (elapsed > 0.0 ? 100.0 * busy / (elapsed * getThreadCount()) : 0.0) << "% utilisation" << std::endl;
+        }
+
+    private:
+        static constexpr size_t CHUNKS_PER_THREAD = 4;
+
+        struct Queue {
+            std::mutex mutex;
+            std::deque<Handle> jobs;
+        };
+
+        struct Stats {
+            std::atomic<size_t> jobs{0};
+            std::atomic<uint64_t> busyNanoseconds{0};
+        };
+
+        std::vector<std::thread> _threads;
+        std::vector<std::unique_ptr<Queue>> _queues;       // One per worker, then the injection and background queues
+        std::unique_ptr<Stats[]> _stats;                   // One per worker, then the outside threads
+        std::atomic<size_t> _queued{0};
+        std::atomic<size_t> _injected{0};                  // Jobs in the injection queue, the only ones outside threads run
+        std::atomic<bool> _running{true};
+        std::mutex _sleepMutex;
+        std::condition_variable _sleep;
+        std::chrono::steady_clock::time_point _lastReport = std::chrono::steady_clock::now();
+
+        static int &currentWorker() {
+            static thread_local int worker = -1;
+            return worker;
+        }
+
+        JobSystem() {
+            size_t workers = std::max<size_t>(2, std::thread::hardware_concurrency()) - 1;
+            for (size_t i = 0; i < workers + 2; i++)
+                _queues.push_back(std::make_unique<Queue>());
+            _stats.reset(new Stats[workers + 1]);
+            for (size_t i = 0; i < workers; i++)
+                _threads.emplace_back([this, i]() { workerLoop(static_cast<int>(i)); });
+        }
+
+        void workerLoop(int index) {
+            currentWorker() = index;
+            while (_running) {
+                if (runOne())
+                    continue;
+                std::unique_lock<std::mutex> lock(_sleepMutex);
+                _sleep.wait(lock, [this]() { return !_running || _queued > 0; });
+            }
+        }
+
+        Handle submit(std::function<void()> work, std::vector<Handle> const &dependencies, bool background) {
+            auto job = std::make_shared<Job>();
+            job->work = std::move(work);
+            job->background = background;
+            job->pendingDependencies += dependencies.size();
+            for (auto const &dependency : dependencies) {
+                std::lock_guard<std::mutex> lock(dependency->mutex);
+                if (dependency->done)
+                    job->pendingDependencies--;
+                else
+                    dependency->dependents.push_back(job);
+            }
+            if (--job->pendingDependencies == 0)
+                schedule(job);
+            return job;
+        }
+
+        /* Filled before the workers start, unlike _threads */
+        size_t injectionQueue() const { return _queues.size() - 2; }
+        size_t backgroundQueue() const { return _queues.size() - 1; }
+
+        /* Whether the calling thread has a queued job it is allowed to run */
+        bool hasRunnable() const { return currentWorker() >= 0 ? _queued > 0 : _injected > 0; }
+
+        void schedule(Handle const &job) {
+            int worker = currentWorker();
+            size_t index = job->background ? backgroundQueue() : worker >= 0 ? worker : injectionQueue();
+            {
+                std::lock_guard<std::mutex> lock(_queues[index]->mutex);
+                _queues[index]->jobs.push_back(job);
+            }
+            if (index == injectionQueue())
+                _injected++;
+            _queued++;
+            notify();
+        }
+
+        /* Taking the lock orders the notification after a concurrent sleeper checked its predicate */
+        void notify() {
+            { std::lock_guard<std::mutex> lock(_sleepMutex); }
+            _sleep.notify_all();
+        }
+
+        /* Workers: own deque from the back, then the injection queue, then steal from the other workers'
+         * front, then the background queue. Outside threads: the injection queue only. */
+        Handle take() {
+            int worker = currentWorker();
+            if (worker < 0)
+                return pop(injectionQueue(), false);
+            if (Handle job = pop(worker, true))
+                return job;
+            for (size_t k = 0; k <= injectionQueue(); k++) {
+                size_t index = (injectionQueue() + k) % (injectionQueue() + 1);
+                if (index == static_cast<size_t>(worker))
+                    continue;
+                if (Handle job = pop(index, false))
+                    return job;
+            }
+            return pop(backgroundQueue(), false);
+        }
+
+        Handle pop(size_t index, bool back) {
+            Queue &queue = *_queues[index];
+            std::lock_guard<std::mutex> lock(queue.mutex);
+            if (queue.jobs.empty())
+                return nullptr;
+            Handle job = back ? queue.jobs.back() : queue.jobs.front();
+            if (back)
+                queue.jobs.pop_back();
+            else
+                queue.jobs.pop_front();
+            if (index == injectionQueue())
+                _injected--;
+            return job;
+        }
+
+        bool runOne() {
+            Handle job = take();
+            if (!job)
+                return false;
+            _queued--;
+
+            auto start = std::chrono::steady_clock::now();
+            try {
+                job->work();
+            } catch (...) {
+                job->error = std::current_exception();
+            }
+            int worker = currentWorker();
+            Stats &stats = _stats[worker >= 0 ? worker : _threads.size()];
+            stats.jobs++;
+            stats.busyNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+
+            std::vector<Handle> dependents;
+            {
+                std::lock_guard<std::mutex> lock(job->mutex);
+                job->done = true;
+                job->work = nullptr;
+                dependents.swap(job->dependents);
+            }
+            for (auto const &dependent : dependents)
+                if (--dependent->pendingDependencies == 0)
+                    schedule(dependent);
+            notify();
+            return true;
+        }
+};
@@ -180,7 +180,20 @@ public:
         return result;
     }
 
-	const float *get_data() {
+	/* Element-wise blend, close enough to the real interpolation for the small changes of one update step */
+	static Matrix lerp(Matrix const &a, Matrix const &b, float t) {
+		Matrix result;
+		for (int i = 0; i < 16; i++)
+			result.data[i] = a.data[i] + (b.data[i] - a.data[i]) * t;
+		return result;
+	}
+
+	const float *get_data() const {
 		return data;
 	}
+
+	void set_data(const float *values) {
+		for (int i = 0; i < 16; i++)
+			data[i] = values[i];
+	}
 };
@@ -2,23 +2,57 @@
 
 #include <GL/glew.h>
 #include <vector>
+#include <map>
+#include <memory>
+#include <algorithm>
+#include <utility>
+#include <cstring>
 
 #include "Parser.hpp"
+#include "Shader.hpp"
+#include "Transform.hpp"
 #include "MeshVertex.hpp"
+#include "MeshBatch.hpp"
+#include "StreamBuffer.hpp"
+#include "Frustum.hpp"
+#include "BVH.hpp"
+#include "Meshlets.hpp"
+#include "Simplifier.hpp"
+#include "NormalGenerator.hpp"
+#include "TangentGenerator.hpp"
+#include "JobSystem.hpp"
+#include "TextureManager.hpp"
+#include "OcclusionCuller.hpp"
 
 class Mesh {
     public:
+        /* Everything up to the GL objects is built here, so a mesh can be prepared on a worker thread;
+         * upload() then has to run on the thread owning the context before the first draw */
         Mesh(const std::unordered_map<std::string, Object> &objects) {
             std::cout << "Creating mesh..." << std::endl;
-            
+
             parseObj(objects);
+            setupDraws();
+        }
+
+        /* `previous`, the mesh this one replaces, hands over its vertex, index and tangent buffers when
+         * they have the same size, and only the runs of elements that differ are uploaded again. Editing
+         * texture coordinates, normals or faces in place touches a few of them; moving a vertex also moves
+         * the centroid the mesh is recentred on, so the vertex buffer then goes whole. */
+        void upload(Mesh *previous = nullptr) {
+            if (_uploaded)
+                return;
+            _uploaded = true;
+            previous = previous && previous->_uploaded ? previous : nullptr;
+            size_t uploaded = 0;
 
             glGenVertexArrays(1, &_vao);
             glBindVertexArray(_vao);
 
-            glGenBuffers(1, &_vbo);
-            glBindBuffer(GL_ARRAY_BUFFER, _vbo);
-            glBufferData(GL_ARRAY_BUFFER, _vertices.size() * sizeof(MeshVertex), _vertices.data(), GL_STATIC_DRAW);
+            _vbo = uploadBuffer(GL_ARRAY_BUFFER, _vertices, previous ? &previous->_vertices : nullptr,
+                previous ? &previous->_vbo : nullptr, uploaded);
+            _ebo = uploadBuffer(GL_ELEMENT_ARRAY_BUFFER, _indices, previous ? &previous->_indices : nullptr,
+                previous ? &previous->_ebo : nullptr, uploaded);
 
             glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void *)offsetof(MeshVertex, position));
             glEnableVertexAttribArray(0);
@@ -31,68 +65,662 @@ class Mesh {
             glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void *)offsetof(MeshVertex, texCoord));
             glEnableVertexAttribArray(2);
 
+            /* Tangents live in their own buffer so meshes without texture coordinates do not pay for them */
+            if (_hasTangents) {
+                bool reuse = previous && previous->_hasTangents;
+                _tangentVbo = uploadBuffer(GL_ARRAY_BUFFER, _tangents, reuse ? &previous->_tangents : nullptr,
+                    reuse ? &previous->_tangentVbo : nullptr, uploaded);
+                glVertexAttribPointer(TANGENT_ATTRIB, 4, GL_FLOAT, GL_FALSE, 0, (void *)0);
+                glEnableVertexAttribArray(TANGENT_ATTRIB);
+            }
+
+            uploadDraws();
+
             glBindVertexArray(0);
 
-            std::cout << "Mesh created successfully" << std::endl;
+            std::cout << "Mesh created successfully (" << _draws.size() << " draws, " << _materials.size()
+                << " materials, " << getMeshletCount() << " meshlets, " << (_useIndirect ? "multi-draw indirect" : "direct") << " submission)" << std::endl;
+            if (previous)
+                std::cout << "Mesh buffers reused, " << uploaded << " of " << getGeometryBytes() << " bytes uploaded" << std::endl;
         }
-        
+
         ~Mesh() {
+            if (!_uploaded)
+                return;
             glDeleteVertexArrays(1, &_vao);
             glDeleteBuffers(1, &_vbo);
+            glDeleteBuffers(1, &_ebo);
+            if (_hasTangents)
+                glDeleteBuffers(1, &_tangentVbo);
+            glDeleteBuffers(1, &_drawDataBuffer);
+            glDeleteTextures(1, &_drawDataTexture);
+            glDeleteBuffers(1, &_materialBuffer);
+            glDeleteTextures(1, &_materialTexture);
+            if (_useIndirect)
+                glDeleteBuffers(1, &_drawIdBuffer);
         }
 
-        void draw() const {
+        /* Keep the draws whose bounds intersect the view frustum. Each of them is drawn at the coarsest
+         * level of detail whose error projects to less than the pixel threshold; full detail draws are
+         * further culled per meshlet with the sphere and normal cone tests. With `occlusion`, draws and
+         * meshlets hidden behind the depth of the opaque geometry are dropped as well. */
+        void cull(Transform const &transform, float viewportHeight, OcclusionCuller *occlusion = nullptr) {
+            Matrix clip = transform.projectionMat * transform.viewMat * transform.modelMat;
+            Frustum frustum(clip);
+            _visibleDraws.clear();
+            _bvh.query(frustum, _drawBounds, [this](uint32_t drawIndex) { _visibleDraws.push_back(drawIndex); });
+            std::sort(_visibleDraws.begin(), _visibleDraws.end());
+            HiZBuffer const *depth = occlusion ? cullOccluded(*occlusion, clip) : nullptr;
+
+            /* Pixels covered by one mesh unit at distance 1 */
+            float lodScale = transform.projectionMat.get_data()[5] * viewportHeight * 0.5f;
+            std::vector<GLuint> fullDetail;
+            _ranges.clear();
+            for (auto drawIndex : _visibleDraws) {
+                size_t level = selectLod(drawIndex, frustum.getEye(), lodScale);
+                if (level == 0) {
+                    fullDetail.push_back(drawIndex);
+                    continue;
+                }
+                auto const &lod = _drawLods[drawIndex][level - 1];
+                _ranges.push_back({drawIndex, lod.indexOffset, lod.indexCount});
+            }
+            _meshletSet.cull(frustum, _coneCulling, fullDetail, _drawTransformed, _ranges, depth);
+            std::stable_sort(_ranges.begin(), _ranges.end(), [](DrawRange const &a, DrawRange const &b) {
+                return a.drawIndex < b.drawIndex;
+            });
+            partitionRanges();
+
+            _submittedTriangles = 0;
+            for (auto const &range : _ranges)
+                _submittedTriangles += range.indexCount / 3;
+        }
+
+        /* Largest error in pixels tolerated when picking a level of detail, 0 always draws full detail */
+        void setLodThreshold(float pixels) { _lodThreshold = pixels; }
+
+        /* Backface culling of whole meshlets; only correct for closed, consistently wound meshes */
+        void setConeCulling(bool enabled) { _coneCulling = enabled; }
+
+        /* The visible opaque ranges, or the transparent ones, are submitted with a single glMultiDrawElementsIndirect:
+         * the shader looks up the material of each draw in the material table, so nothing changes between draws.
+         * With instanceCount > 1 each range is instanced, the shader fetching the instance transforms with gl_InstanceID. */
+        void draw(Shader const &shader, GLsizei instanceCount = 1, bool transparent = false) {
+            size_t first = transparent ? _opaqueRangeCount : 0;
+            size_t count = transparent ? _ranges.size() - _opaqueRangeCount : _opaqueRangeCount;
             glBindVertexArray(_vao);
-            // glDrawArrays(GL_TRIANGLES, 0, _vertexCount);
-            glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(_vertexCount));
+            glActiveTexture(GL_TEXTURE0 + DRAW_DATA_UNIT);
+            glBindTexture(GL_TEXTURE_BUFFER, _drawDataTexture);
+            shader.setTexture("drawData", DRAW_DATA_UNIT);
+            glActiveTexture(GL_TEXTURE0 + MATERIAL_DATA_UNIT);
+            glBindTexture(GL_TEXTURE_BUFFER, _materialTexture);
+            shader.setTexture("materialData", MATERIAL_DATA_UNIT);
+
+            if (_useIndirect && count) {
+                /* More passes than the region was sized for: start the next one rather than overflow */
+                if (count * sizeof(DrawElementsIndirectCommand) > _commandBuffer->getAvailable())
+                    _commandBuffer->fence();
+                auto *commands = static_cast<DrawElementsIndirectCommand *>(_commandBuffer->begin());
+                for (size_t k = 0; k < count; k++) {
+                    DrawRange const &range = _ranges[first + k];
+                    commands[k] = {
+                        static_cast<GLuint>(range.indexCount), static_cast<GLuint>(instanceCount),
+                        static_cast<GLuint>(range.indexOffset), 0, range.drawIndex
+                    };
+                }
+                size_t commandOffset = _commandBuffer->end(count * sizeof(DrawElementsIndirectCommand));
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, _commandBuffer->getId());
+                glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *)commandOffset, static_cast<GLsizei>(count), 0);
+                glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+            } else if (!_useIndirect) {
+                for (size_t k = first; k < first + count; k++) {
+                    DrawRange const &range = _ranges[k];
+                    glVertexAttribI1ui(DRAW_ID_ATTRIB, range.drawIndex);
+                    glDrawElementsInstanced(GL_TRIANGLES, static_cast<GLsizei>(range.indexCount), GL_UNSIGNED_INT,
+                        (void *)(range.indexOffset * sizeof(GLuint)), instanceCount);
+                }
+            }
+
+            glActiveTexture(GL_TEXTURE0);
             glBindVertexArray(0);
         }
 
+        /* Call once every pass of the frame is drawn: the passes share one region of the command ring */
+        void submitted() {
+            if (_commandBuffer)
+                _commandBuffer->fence();
+        }
+
+        /* Where the maps of a material sit in the texture array, layer -1 for none */
+        struct MaterialMaps {
+            TextureRect diffuse, normal;
+        };
+
+        /* Maps of each material, in getMaterials() order */
+        void setMaterialTextures(std::vector<MaterialMaps> const &maps) {
+            _materialTextures = maps;
+            updateMaterials();
+        }
+
+        /* Copy the current values of the materials into the material table, after their library was reloaded */
+        void updateMaterials() {
+            writeMaterialData();
+            partitionRanges();
+            if (!_uploaded)
+                return;
+            glBindBuffer(GL_TEXTURE_BUFFER, _materialBuffer);
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, _materialData.size() * sizeof(float), _materialData.data());
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+        }
+
+        /* Per-object transform applied on top of the model matrix, shared by all groups of the object */
+        void setObjectTransform(std::string const &objectName, Matrix const &transform) {
+            auto it = std::find(_objectNames.begin(), _objectNames.end(), objectName);
+            if (it == _objectNames.end()) {
+                std::cerr << "Unknown object: " << objectName << std::endl;
+                return;
+            }
+            size_t objectIndex = it - _objectNames.begin();
+            for (size_t i = 0; i < _draws.size(); i++) {
+                if (_draws[i].objectIndex != objectIndex)
+                    continue;
+                writeDrawData(i, transform);
+                _drawTransformed[i] = true;
+                _drawBounds[i] = _localBounds[i].transformed(transform.get_data());
+                if (!_uploaded)
+                    continue;
+                glBindBuffer(GL_TEXTURE_BUFFER, _drawDataBuffer);
+                glBufferSubData(GL_TEXTURE_BUFFER, i * DRAW_DATA_TEXELS * sizeof(float) * 4,
+                    DRAW_DATA_TEXELS * sizeof(float) * 4, &_drawData[i * DRAW_DATA_TEXELS * 4]);
+            }
+            if (_uploaded)
+                glBindBuffer(GL_TEXTURE_BUFFER, 0);
+            _bvh.refit(_drawBounds);
+        }
+
         void parseObj(const std::unordered_map<std::string, Object> &objects) {
+            /* material -> (object, group) -> triangle indices */
+            std::map<Material const *, std::map<std::pair<size_t, std::string>, std::vector<GLuint>>> buckets;
             std::array<float, 3> vertexSum = {0.f, 0.f, 0.f};
-            for (auto const &objPair : objects) {
-                const Object &obj = objPair.second;
+            size_t cornerCount = 0;
+            size_t flatFaces = 0;
+            bool hasTexCoords = false;
+            std::vector<bool> missingNormals;
+
+            for (auto const &objPair : objects)
+                _objectNames.push_back(objPair.first);
+            std::sort(_objectNames.begin(), _objectNames.end());
+
+            for (size_t objectIndex = 0; objectIndex < _objectNames.size(); objectIndex++) {
+                const Object &obj = objects.at(_objectNames[objectIndex]);
+                /* Vertices are shared between faces using the same v/vt/vn triplet */
+                std::unordered_map<VertexKey, GLuint, VertexKeyHash> uniqueVertices;
+
                 for (auto const &group : obj._groups) {
                     for (auto const &face : group.second.faces) {
+                        std::vector<GLuint> corners;
+                        corners.reserve(face.vertexCount);
+
+                        /* Without `vn`, vertices are only shared inside a smoothing group and
+                         * faces outside any group ("s off") get their own, flat shaded, vertices */
+                        int smoothing = 0;
+                        if (face.normalIndices.empty())
+                            smoothing = face.smoothingGroup > 0 ? face.smoothingGroup : -static_cast<int>(++flatFaces);
+
                         for (size_t i = 0; i < face.vertexCount; i++) {
-                            MeshVertex meshVertex;
+                            VertexKey key = {
+                                face.vertexIndices[i],
+                                face.textureIndices.empty() ? -1 : face.textureIndices[i],
+                                face.normalIndices.empty() ? -1 : face.normalIndices[i],
+                                smoothing
+                            };
                             auto vertex = obj.getVertexByIndex(face.vertexIndices[i]);
+                            vertexSum[0] += vertex.x;
+                            vertexSum[1] += vertex.y;
+                            vertexSum[2] += vertex.z;
+                            cornerCount++;
+
+                            auto it = uniqueVertices.find(key);
+                            if (it != uniqueVertices.end()) {
+                                corners.push_back(it->second);
+                                continue;
+                            }
+
+                            MeshVertex meshVertex{};
                             meshVertex.position = std::array<float, 4>{vertex.x, vertex.y, vertex.z, vertex.w};
-                            if (!face.textureIndices.empty()) {
-                                auto texCoord = obj.getTexCoordByIndex(face.textureIndices[i]);
+                            if (key.texCoord >= 0) {
+                                auto texCoord = obj.getTexCoordByIndex(key.texCoord);
                                 meshVertex.texCoord = std::array<float, 3>{texCoord.u, texCoord.v, texCoord.w};
+                                hasTexCoords = true;
                             }
-                            if (!face.normalIndices.empty()) {
-                                if (!_hasNormals)
-                                    _hasNormals = true;
-                                auto normal = obj.getNormalByIndex(face.normalIndices[i]);
+                            if (key.normal >= 0) {
+                                auto normal = obj.getNormalByIndex(key.normal);
                                 meshVertex.normal = std::array<float, 3>{normal.x, normal.y, normal.z};
                             }
+                            GLuint index = static_cast<GLuint>(_vertices.size());
                             _vertices.push_back(meshVertex);
-                            vertexSum[0] += vertex.x;
-                            vertexSum[1] += vertex.y;
-                            vertexSum[2] += vertex.z;
+                            missingNormals.push_back(key.normal < 0);
+                            uniqueVertices.emplace(key, index);
+                            corners.push_back(index);
+                        }
+
+                        /* Polygons are triangulated as a fan around their first corner */
+                        auto &bucket = buckets[face.material][{objectIndex, group.first}];
+                        for (size_t i = 1; i + 1 < corners.size(); i++) {
+                            bucket.push_back(corners[0]);
+                            bucket.push_back(corners[i]);
+                            bucket.push_back(corners[i + 1]);
                         }
                     }
                 }
             }
+
+            buildDraws(buckets);
+
+            if (std::find(missingNormals.begin(), missingNormals.end(), true) != missingNormals.end())
+                NormalGenerator::generate(_vertices, _indices, missingNormals);
+            _hasNormals = !_vertices.empty();
+            if (hasTexCoords) {
+                _tangents = TangentGenerator::generate(_vertices, _indices);
+                _hasTangents = true;
+            }
+
             _vertexCount = _vertices.size();
-            std::array<float, 3> vertexAvg = {vertexSum[0] / _vertexCount, vertexSum[1] / _vertexCount, vertexSum[2] / _vertexCount};
+            if (!cornerCount)
+                return;
+            std::array<float, 3> vertexAvg = {vertexSum[0] / cornerCount, vertexSum[1] / cornerCount, vertexSum[2] / cornerCount};
             for (auto &vec : _vertices) {
                 vec.position[0] -= vertexAvg[0];
                 vec.position[1] -= vertexAvg[1];
                 vec.position[2] -= vertexAvg[2];
+                _boundingRadius = std::max(_boundingRadius,
+                    std::sqrt(vec.position[0] * vec.position[0] + vec.position[1] * vec.position[1] + vec.position[2] * vec.position[2]));
             }
+
+            /* Bounds of every object/group chunk, indexed by draw, and the hierarchy over them */
+            _localBounds.assign(_draws.size(), AABB());
+            for (size_t i = 0; i < _draws.size(); i++) {
+                for (size_t j = _draws[i].indexOffset; j < _draws[i].indexOffset + _draws[i].indexCount; j++) {
+                    auto const &position = _vertices[_indices[j]].position;
+                    _localBounds[i].expand(position[0], position[1], position[2]);
+                }
+            }
+            _drawBounds = _localBounds;
+            _drawTransformed.assign(_draws.size(), false);
+
+            /* The hierarchy, the meshlets and the simplified levels only read the geometry and run
+             * concurrently; the levels are appended to the index buffer once the meshlets are done with it */
+            auto &jobs = JobSystem::instance();
+            std::vector<std::vector<PendingLod>> levels(_draws.size());
+            auto bvh = jobs.submit([this]() { _bvh.build(_drawBounds); });
+            auto meshlets = jobs.submit([this]() { _meshletSet.build(_vertices, _indices, _draws); });
+            auto simplify = jobs.submit([this, &levels]() { simplifyLods(levels); });
+            auto append = jobs.submit([this, &levels]() { appendLods(levels); }, {meshlets, simplify});
+            jobs.waitAll({bvh, meshlets, simplify, append});
+            jobs.report("Mesh processing");
         }
 
         bool getHasNormals() const { return _hasNormals; }
+        bool getHasTangents() const { return _hasTangents; }
+
+        /* Sphere around the origin (the centroid the vertices were centered on) enclosing the mesh */
+        std::array<float, 3> getBoundingCenter() const { return {0.0f, 0.0f, 0.0f}; }
+        float getBoundingRadius() const { return _boundingRadius; }
 
         GLuint getVao() const { return _vao; }
         std::vector<MeshVertex> const &getVertices() const { return _vertices; }
+        std::vector<GLuint> const &getIndices() const { return _indices; }
+        std::vector<std::array<float, 4>> const &getTangents() const { return _tangents; }
+        std::vector<MeshDraw> const &getDraws() const { return _draws; }
+        std::vector<Material const *> const &getMaterials() const { return _materials; }
+        std::vector<std::string> const &getObjectNames() const { return _objectNames; }
+        std::vector<AABB> const &getDrawBounds() const { return _drawBounds; }
+        std::vector<DrawRange> const &getRanges() const { return _ranges; }
+        /* Visible ranges are ordered opaque first, see partitionRanges() */
+        bool hasTransparentRanges() const { return _opaqueRangeCount < _ranges.size(); }
+        size_t getVisibleDrawCount() const { return _visibleDraws.size(); }
+        size_t getMeshletCount() const { return _meshletSet.getMeshlets().size(); }
+        std::vector<std::vector<MeshLod>> const &getLods() const { return _drawLods; }
+        size_t getSubmittedTriangles() const { return _submittedTriangles; }
+        /* Full detail triangles of every draw, what is submitted without any culling */
+        size_t getTriangleCount() const {
+            size_t triangles = 0;
+            for (auto const &draw : _draws)
+                triangles += draw.indexCount / 3;
+            return triangles;
+        }
 
     private:
-        GLuint _vao, _vbo;
+        /* Per-draw data is a mat4 followed by (materialIndex, 0, 0, 0), stored as RGBA32F texels */
+        static constexpr size_t DRAW_DATA_TEXELS = 5;
+        static constexpr GLuint DRAW_ID_ATTRIB = 3;
+        static constexpr GLuint DRAW_DATA_UNIT = 1;
+        /* Material table: (ambient, dissolve), (diffuse, shininess), (specular, optical density),
+         * (transmission filter, illumination), (diffuse map offset, scale), (diffuse map layer, normal
+         * map layer, 0, 0) and (normal map offset, scale) RGBA32F texels, indexed by MeshDraw::materialIndex */
+        static constexpr size_t MATERIAL_TEXELS = 7;
+        static constexpr GLuint MATERIAL_DATA_UNIT = 3;
+        static constexpr GLuint TANGENT_ATTRIB = 4;
+        /* The draw index attribute must stay constant across the instances of a draw, so it only
+         * advances every 2^31 instances: its value is always the command's baseInstance */
+        static constexpr GLuint DRAW_ID_DIVISOR = 0x80000000u;
+        static constexpr size_t PASSES_PER_FRAME = 3; // Depth pre-pass, opaque and transparent
+
+        struct VertexKey {
+            int position, texCoord, normal;
+            int smoothing; // Smoothing group, or a unique negative id for flat faces, when normals are generated
+
+            bool operator==(VertexKey const &rhs) const {
+                return position == rhs.position && texCoord == rhs.texCoord && normal == rhs.normal && smoothing == rhs.smoothing;
+            }
+        };
+
+        struct VertexKeyHash {
+            size_t operator()(VertexKey const &key) const {
+                size_t h = std::hash<int>()(key.position);
+                h ^= std::hash<int>()(key.texCoord) + 0x9e3779b9 + (h << 6) + (h >> 2);
+                h ^= std::hash<int>()(key.normal) + 0x9e3779b9 + (h << 6) + (h >> 2);
+                h ^= std::hash<int>()(key.smoothing) + 0x9e3779b9 + (h << 6) + (h >> 2);
+                return h;
+            }
+        };
+
+        GLuint _vao = 0, _vbo = 0, _ebo = 0, _tangentVbo = 0;
+        bool _uploaded = false;
+        GLuint _drawDataBuffer = 0, _drawDataTexture = 0, _drawIdBuffer = 0;
+        GLuint _materialBuffer = 0, _materialTexture = 0;
+        bool _useIndirect = false;
+        std::unique_ptr<StreamBuffer> _commandBuffer;
+        float _boundingRadius = 0.0f;
         std::vector<MeshVertex> _vertices;
+        std::vector<GLuint> _indices;
+        std::vector<MeshDraw> _draws;
+        std::vector<Material const *> _materials;
+        std::vector<std::string> _objectNames;
+        std::vector<float> _drawData;
+        std::vector<float> _materialData;
+        std::vector<MaterialMaps> _materialTextures;
+        std::vector<bool> _materialTransparent; // Dissolve below 1, drawn in the transparent pass
+        size_t _opaqueRangeCount = 0;
+        std::vector<AABB> _localBounds, _drawBounds;
+        BVH _bvh;
+        std::vector<GLuint> _visibleDraws;
+        std::vector<bool> _drawTransformed;
+        MeshletSet _meshletSet;
+        std::vector<DrawRange> _ranges;
+        bool _coneCulling = false;
+        std::vector<std::vector<MeshLod>> _drawLods; // Coarser levels of each draw, level 0 excluded
+        float _lodThreshold = 1.0f;
+
+        static constexpr size_t MAX_LODS = 6;
+        static constexpr size_t MIN_LOD_TRIANGLES = 64;
+        size_t _submittedTriangles = 0;
         size_t _vertexCount;
         bool _hasNormals = false;
-};
\ No newline at end of file
+        std::vector<std::array<float, 4>> _tangents; // xyz tangent, w bitangent sign
+        bool _hasTangents = false;
+
+        /* Concatenate the buckets into one index buffer ordered by material (opaque ones first, default first,
+         * then by name), then by object and group, one draw per group, so the transparent geometry
+         * follows all of the opaque geometry */
+        void buildDraws(std::map<Material const *, std::map<std::pair<size_t, std::string>, std::vector<GLuint>>> &buckets) {
+            for (auto const &bucket : buckets)
+                _materials.push_back(bucket.first);
+
+            std::sort(_materials.begin(), _materials.end(), [](Material const *a, Material const *b) {
+                if (isTransparent(a) != isTransparent(b))
+                    return isTransparent(b);
+                if (!a || !b)
+                    return a == nullptr && b != nullptr;
+                return a->_name < b->_name;
+            });
+
+            for (size_t materialIndex = 0; materialIndex < _materials.size(); materialIndex++) {
+                for (auto const &range : buckets[_materials[materialIndex]]) {
+                    if (range.second.empty())
+                        continue;
+                    _draws.push_back({_indices.size(), range.second.size(), range.first.first, materialIndex});
+                    _indices.insert(_indices.end(), range.second.begin(), range.second.end());
+                }
+            }
+        }
+
+        struct PendingLod {
+            std::vector<GLuint> indices;
+            float error; // Accumulated over the coarser levels
+        };
+
+        /* Halve each draw until it stops simplifying well, draws are independent and run in parallel */
+        void simplifyLods(std::vector<std::vector<PendingLod>> &levels) const {
+            JobSystem::instance().parallelFor(_draws.size(), 1, [&](size_t first, size_t last) {
+                for (size_t d = first; d < last; d++) {
+                    GLuint const *source = &_indices[_draws[d].indexOffset];
+                    size_t count = _draws[d].indexCount;
+                    float error = 0.0f;
+
+                    while (levels[d].size() < MAX_LODS && count / 3 > MIN_LOD_TRIANGLES) {
+                        float collapseError = 0.0f;
+                        std::vector<GLuint> simplified = Simplifier::simplify(_vertices, source, count, count / 2, collapseError);
+                        if (simplified.empty() || simplified.size() > count * 85 / 100)
+                            break;
+
+                        error += collapseError;
+                        count = simplified.size();
+                        levels[d].push_back({std::move(simplified), error});
+                        source = levels[d].back().indices.data();
+                    }
+                }
+            });
+        }
+
+        /* Store the levels after the full detail indices, in draw order */
+        void appendLods(std::vector<std::vector<PendingLod>> const &levels) {
+            _drawLods.assign(_draws.size(), {});
+            size_t lodTriangles = 0;
+            for (size_t d = 0; d < _draws.size(); d++) {
+                for (auto const &level : levels[d]) {
+                    _drawLods[d].push_back({_indices.size(), level.indices.size(), level.error});
+                    _indices.insert(_indices.end(), level.indices.begin(), level.indices.end());
+                    lodTriangles += level.indices.size() / 3;
+                }
+            }
+            std::cout << "Generated " << lodTriangles << " level of detail triangles" << std::endl;
+        }
+
+        /* 0 is full detail, i > 0 is _drawLods[drawIndex][i - 1] */
+        size_t selectLod(size_t drawIndex, std::array<float, 3> const &eye, float lodScale) const {
+            auto const &lods = _drawLods[drawIndex];
+            if (_lodThreshold <= 0.0f || lods.empty())
+                return 0;
+
+            AABB const &bounds = _drawBounds[drawIndex];
+            float dx = bounds.center(0) - eye[0], dy = bounds.center(1) - eye[1], dz = bounds.center(2) - eye[2];
+            float ex = bounds.max[0] - bounds.min[0], ey = bounds.max[1] - bounds.min[1], ez = bounds.max[2] - bounds.min[2];
+            float radius = 0.5f * std::sqrt(ex * ex + ey * ey + ez * ez);
+            float distance = std::sqrt(dx * dx + dy * dy + dz * dz) - radius;
+            if (distance <= 0.0f)
+                return 0;
+
+            for (size_t level = lods.size(); level > 0; level--)
+                if (lods[level - 1].error * lodScale / distance <= _lodThreshold)
+                    return level;
+            return 0;
+        }
+
+        /* Drop the visible draws hidden in the occlusion depth, rasterizing the opaque ones first when
+         * there is no GPU depth. Occluders are drawn at full detail: simplified levels may fill
+         * concavities in front of the actual surface and hide what shows through them. */
+        HiZBuffer const *cullOccluded(OcclusionCuller &occlusion, Matrix const &clip) {
+            HiZBuffer const *depth = occlusion.prepare(clip);
+            if (!depth) {
+                DepthRasterizer &rasterizer = occlusion.beginRasterization(clip);
+                for (auto drawIndex : _visibleDraws) {
+                    MeshDraw const &draw = _draws[drawIndex];
+                    if (_materialTransparent[draw.materialIndex])
+                        continue;
+                    rasterizer.drawTriangles(_vertices, _indices, draw.indexOffset, draw.indexCount,
+                        _drawTransformed[drawIndex] ? &_drawData[drawIndex * DRAW_DATA_TEXELS * 4] : nullptr);
+                }
+                depth = &occlusion.finishRasterization(clip);
+            }
+
+            size_t tested = _visibleDraws.size();
+            _visibleDraws.erase(std::remove_if(_visibleDraws.begin(), _visibleDraws.end(), [&](GLuint drawIndex) {
+                return depth->isOccluded(_drawBounds[drawIndex]);
+            }), _visibleDraws.end());
+            occlusion.count(tested, tested - _visibleDraws.size());
+            return depth;
+        }
+
+        void writeDrawData(size_t drawIndex, Matrix const &transform) {
+            float *texels = &_drawData[drawIndex * DRAW_DATA_TEXELS * 4];
+            std::copy(transform.get_data(), transform.get_data() + 16, texels);
+            texels[16] = static_cast<float>(_draws[drawIndex].materialIndex);
+            texels[17] = texels[18] = texels[19] = 0.0f;
+        }
+
+        static bool isTransparent(Material const *material) {
+            return material && material->_dissolve < 1.0f;
+        }
+
+        /* Move the transparent ranges after the opaque ones. Draws are built in that order, so this only
+         * moves anything after a material library reload changed a dissolve value. */
+        void partitionRanges() {
+            auto transparent = [this](DrawRange const &range) { return _materialTransparent[_draws[range.drawIndex].materialIndex]; };
+            auto end = std::stable_partition(_ranges.begin(), _ranges.end(), [&](DrawRange const &range) { return !transparent(range); });
+            _opaqueRangeCount = static_cast<size_t>(end - _ranges.begin());
+        }
+
+        /* Faces without a material are drawn with a neutral white material */
+        void writeMaterialData() {
+            static const Material defaultMaterial = [] {
+                Material m("default");
+                m._ambient = {1.0f, 1.0f, 1.0f};
+                m._diffuse = {1.0f, 1.0f, 1.0f};
+                return m;
+            }();
+
+            /* One entry at least, empty buffers cannot back a texture everywhere */
+            _materialData.assign(std::max<size_t>(_materials.size(), 1) * MATERIAL_TEXELS * 4, 0.0f);
+            _materialTransparent.assign(_materials.size(), false);
+            for (size_t i = 0; i < _materials.size(); i++) {
+                _materialTransparent[i] = isTransparent(_materials[i]);
+                Material const &m = _materials[i] ? *_materials[i] : defaultMaterial;
+                MaterialMaps maps = i < _materialTextures.size() ? _materialTextures[i] : MaterialMaps();
+                TextureRect const &map = maps.diffuse, &normalMap = maps.normal;
+                float *texels = &_materialData[i * MATERIAL_TEXELS * 4];
+                float const values[MATERIAL_TEXELS * 4] = {
+                    m._ambient.r, m._ambient.g, m._ambient.b, m._dissolve,
+                    m._diffuse.r, m._diffuse.g, m._diffuse.b, m._specularExponent,
+                    m._specular.r, m._specular.g, m._specular.b, m._opticalDensity,
+                    m._transmissionFilter.r, m._transmissionFilter.g, m._transmissionFilter.b, static_cast<float>(m._illumination),
+                    map.offset[0], map.offset[1], map.scale[0], map.scale[1],
+                    map.layer, normalMap.layer, 0.0f, 0.0f,
+                    normalMap.offset[0], normalMap.offset[1], normalMap.scale[0], normalMap.scale[1]
+                };
+                std::copy(values, values + MATERIAL_TEXELS * 4, texels);
+            }
+        }
+
+        /* Upload the per-draw data and, when the driver supports it, set up the streamed indirect commands.
+         * Per-draw data lives in a texture buffer rather than an SSBO so the 4.1 core context
+         * requested by App (the macOS ceiling) keeps working; the draw index reaches the shader
+         * through an instanced attribute offset by baseInstance. */
+        void setupDraws() {
+            _drawData.assign(_draws.size() * DRAW_DATA_TEXELS * 4, 0.0f);
+            Matrix identity;
+            for (size_t i = 0; i < _draws.size(); i++)
+                writeDrawData(i, identity);
+            writeMaterialData();
+
+            /* Everything is visible until the first cull() */
+            _visibleDraws.resize(_draws.size());
+            for (size_t i = 0; i < _draws.size(); i++) {
+                _visibleDraws[i] = static_cast<GLuint>(i);
+                _ranges.push_back({static_cast<GLuint>(i), _draws[i].indexOffset, _draws[i].indexCount});
+            }
+            partitionRanges();
+        }
+
+        size_t getGeometryBytes() const {
+            return _vertices.size() * sizeof(MeshVertex) + _indices.size() * sizeof(GLuint)
+                + (_hasTangents ? _tangents.size() * sizeof(_tangents[0]) : 0);
+        }
+
+        /* Runs of changed elements closer than this are uploaded as one, fewer calls for a few more bytes */
+        static constexpr size_t UPLOAD_MERGE_GAP = 64;
+
+        /* Create the buffer holding `data`, or take over `*previousBuffer` when it holds `previousData`
+         * of the same size and upload only the elements that differ, adding the bytes sent to `uploaded` */
+        template <typename Element>
+        static GLuint uploadBuffer(GLenum target, std::vector<Element> const &data, std::vector<Element> const *previousData,
+            GLuint *previousBuffer, size_t &uploaded) {
+            GLuint buffer = 0;
+            if (!previousBuffer || !*previousBuffer || previousData->size() != data.size()) {
+                glGenBuffers(1, &buffer);
+                glBindBuffer(target, buffer);
+                glBufferData(target, data.size() * sizeof(Element), data.data(), GL_STATIC_DRAW);
+                uploaded += data.size() * sizeof(Element);
+                return buffer;
+            }
+
+            /* The previous mesh no longer owns it, its destructor skips it */
+            buffer = std::exchange(*previousBuffer, 0);
+            glBindBuffer(target, buffer);
+            auto differs = [&](size_t i) { return std::memcmp(&data[i], &(*previousData)[i], sizeof(Element)) != 0; };
+            size_t i = 0;
+            while (i < data.size()) {
+                if (!differs(i)) {
+                    i++;
+                    continue;
+                }
+                size_t first = i, last = i + 1;
+                for (i = last; i < data.size() && i - last < UPLOAD_MERGE_GAP; i++)
+                    if (differs(i))
+                        last = i + 1;
+                glBufferSubData(target, first * sizeof(Element), (last - first) * sizeof(Element), &data[first]);
+                uploaded += (last - first) * sizeof(Element);
+                i = last;
+            }
+            return buffer;
+        }
+
+        void uploadDraws() {
+            glGenBuffers(1, &_drawDataBuffer);
+            glBindBuffer(GL_TEXTURE_BUFFER, _drawDataBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, _drawData.size() * sizeof(float), _drawData.data(), GL_DYNAMIC_DRAW);
+            glGenTextures(1, &_drawDataTexture);
+            glBindTexture(GL_TEXTURE_BUFFER, _drawDataTexture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, _drawDataBuffer);
+
+            glGenBuffers(1, &_materialBuffer);
+            glBindBuffer(GL_TEXTURE_BUFFER, _materialBuffer);
+            glBufferData(GL_TEXTURE_BUFFER, _materialData.size() * sizeof(float), _materialData.data(), GL_STATIC_DRAW);
+            glGenTextures(1, &_materialTexture);
+            glBindTexture(GL_TEXTURE_BUFFER, _materialTexture);
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, _materialBuffer);
+            glBindTexture(GL_TEXTURE_BUFFER, 0);
+            glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+            _useIndirect = GLEW_VERSION_4_3 || (GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance);
+            if (!_useIndirect)
+                return;
+
+            std::vector<GLuint> drawIds(_draws.size());
+            for (size_t i = 0; i < _draws.size(); i++)
+                drawIds[i] = static_cast<GLuint>(i);
+
+            glGenBuffers(1, &_drawIdBuffer);
+            glBindBuffer(GL_ARRAY_BUFFER, _drawIdBuffer);
+            glBufferData(GL_ARRAY_BUFFER, drawIds.size() * sizeof(GLuint), drawIds.data(), GL_STATIC_DRAW);
+            glVertexAttribIPointer(DRAW_ID_ATTRIB, 1, GL_UNSIGNED_INT, sizeof(GLuint), (void *)0);
+            glVertexAttribDivisor(DRAW_ID_ATTRIB, DRAW_ID_DIVISOR);
+            glEnableVertexAttribArray(DRAW_ID_ATTRIB);
+
+            /* Culling never yields more ranges than there are meshlets plus coarse draws, and a frame draws
+             * them in at most PASSES_PER_FRAME passes */
+            size_t maxCommands = _draws.size() + getMeshletCount() + 1;
+            _commandBuffer = std::make_unique<StreamBuffer>(GL_DRAW_INDIRECT_BUFFER,
+                PASSES_PER_FRAME * maxCommands * sizeof(DrawElementsIndirectCommand));
+        }
+};
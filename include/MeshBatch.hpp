@@ -0,0 +1,35 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <cstddef>
+
+/* Layout mandated by glMultiDrawElementsIndirect */
+struct DrawElementsIndirectCommand {
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLuint baseVertex;
+    GLuint baseInstance;
+};
+
+/* Index range of one group of one object, drawn with a single material */
+struct MeshDraw {
+    size_t indexOffset;
+    size_t indexCount;
+    size_t objectIndex;
+    size_t materialIndex;
+};
+
+/* Simplified version of a draw, stored after the full detail indices in the same index buffer */
+struct MeshLod {
+    size_t indexOffset;
+    size_t indexCount;
+    float error; // Largest deviation from the full detail surface, in mesh units
+};
+
+/* Part of a draw that survived culling, submitted as one command */
+struct DrawRange {
+    GLuint drawIndex;
+    size_t indexOffset;
+    size_t indexCount;
+};
@@ -0,0 +1,198 @@
+#pragma once
+
+#include <vector>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include "MeshVertex.hpp"
+#include "MeshBatch.hpp"
+#include "Frustum.hpp"
+#include "BVH.hpp"
+#include "HiZBuffer.hpp"
+#include "Parallel.hpp"
+
+/* Cluster of at most MAX_VERTICES unique vertices and MAX_TRIANGLES triangles, contiguous in the index buffer */
+struct Meshlet {
+    GLuint drawIndex;
+    size_t indexOffset;
+    size_t indexCount;
+    std::array<float, 3> center;
+    float radius;
+    std::array<float, 3> coneAxis;
+    float coneCutoff; // > 1 when the triangles face too many directions to ever be culled
+};
+
+/* Meshlets of every draw with their bounding spheres and normal cones, culled on the CPU
+ * before submission. Partitioning is greedy in index order, which keeps each meshlet
+ * a contiguous index range so nothing is reordered in the GPU buffers. */
+class MeshletSet {
+    public:
+        static constexpr size_t MAX_VERTICES = 64;
+        static constexpr size_t MAX_TRIANGLES = 124;
+        /* Below this many candidates, threads cost more than they save */
+        static constexpr size_t PARALLEL_THRESHOLD = 4096;
+
+        void build(std::vector<MeshVertex> const &vertices, std::vector<GLuint> const &indices, std::vector<MeshDraw> const &draws) {
+            _meshlets.clear();
+            _drawMeshlets.assign(draws.size(), {0, 0});
+            std::vector<uint32_t> stamp(vertices.size(), 0);
+            uint32_t currentStamp = 0;
+
+            for (size_t d = 0; d < draws.size(); d++) {
+                _drawMeshlets[d].first = _meshlets.size();
+                size_t end = draws[d].indexOffset + draws[d].indexCount;
+                size_t start = draws[d].indexOffset;
+                size_t uniqueCount = 0;
+                currentStamp++;
+
+                for (size_t t = start; t < end; t += 3) {
+                    size_t newVertices = 0;
+                    for (size_t k = 0; k < 3; k++)
+                        if (stamp[indices[t + k]] != currentStamp)
+                            newVertices++;
+
+                    if (uniqueCount + newVertices > MAX_VERTICES || (t - start) / 3 >= MAX_TRIANGLES) {
+                        addMeshlet(vertices, indices, static_cast<GLuint>(d), start, t - start);
+                        start = t;
+                        uniqueCount = 0;
+                        currentStamp++;
+                        newVertices = 3;
+                    }
+                    for (size_t k = 0; k < 3; k++)
+                        stamp[indices[t + k]] = currentStamp;
+                    uniqueCount += newVertices;
+                }
+                if (end > start)
+                    addMeshlet(vertices, indices, static_cast<GLuint>(d), start, end - start);
+                _drawMeshlets[d].second = _meshlets.size() - _drawMeshlets[d].first;
+            }
+        }
+
+        /* Append the surviving parts of the visible draws to `ranges`, merging adjacent meshlets.
+         * Draws flagged in `transformed` carry an object transform the meshlet bounds do not
+         * account for, so they are kept whole. Meshlets hidden in `occlusion`, when given, are skipped. */
+        void cull(Frustum const &frustum, bool coneCulling, std::vector<GLuint> const &visibleDraws,
+            std::vector<bool> const &transformed, std::vector<DrawRange> &ranges, HiZBuffer const *occlusion = nullptr) const {
+            std::vector<size_t> candidates;
+            for (auto drawIndex : visibleDraws) {
+                auto const &span = _drawMeshlets[drawIndex];
+                if (transformed[drawIndex]) {
+                    for (size_t i = span.first; i < span.first + span.second; i++)
+                        candidates.push_back(i | WHOLE_BIT);
+                    continue;
+                }
+                for (size_t i = span.first; i < span.first + span.second; i++)
+                    candidates.push_back(i);
+            }
+
+            size_t workers = Parallel::workerCount(candidates.size(), PARALLEL_THRESHOLD);
+            if (workers == 1) {
+                cullRange(frustum, coneCulling, occlusion, candidates, 0, candidates.size(), ranges);
+                return;
+            }
+
+            std::vector<std::vector<DrawRange>> results(workers);
+            Parallel::forRanges(workers, candidates.size(), [&](size_t worker, size_t first, size_t last) {
+                cullRange(frustum, coneCulling, occlusion, candidates, first, last, results[worker]);
+            });
+            for (auto const &result : results)
+                for (auto const &range : result)
+                    append(ranges, range);
+        }
+
+        std::vector<Meshlet> const &getMeshlets() const { return _meshlets; }
+
+    private:
+        static constexpr size_t WHOLE_BIT = size_t(1) << (sizeof(size_t) * 8 - 1);
+
+        std::vector<Meshlet> _meshlets;
+        std::vector<std::pair<size_t, size_t>> _drawMeshlets; // first meshlet, meshlet count
+
+        void addMeshlet(std::vector<MeshVertex> const &vertices, std::vector<GLuint> const &indices, GLuint drawIndex, size_t offset, size_t count) {
+            Meshlet meshlet{drawIndex, offset, count, {0.0f, 0.0f, 0.0f}, 0.0f, {0.0f, 0.0f, 0.0f}, 2.0f};
+
+            AABB bounds;
+            for (size_t i = offset; i < offset + count; i++) {
+                auto const &p = vertices[indices[i]].position;
+                bounds.expand(p[0], p[1], p[2]);
+            }
+            for (int axis = 0; axis < 3; axis++)
+                meshlet.center[axis] = bounds.center(axis);
+            for (size_t i = offset; i < offset + count; i++) {
+                auto const &p = vertices[indices[i]].position;
+                float dx = p[0] - meshlet.center[0], dy = p[1] - meshlet.center[1], dz = p[2] - meshlet.center[2];
+                meshlet.radius = std::max(meshlet.radius, std::sqrt(dx * dx + dy * dy + dz * dz));
+            }
+
+            /* Normal cone: average of the triangle normals, opened to the least aligned one */
+            std::vector<std::array<float, 3>> normals;
+            std::array<float, 3> axis = {0.0f, 0.0f, 0.0f};
+            for (size_t i = offset; i < offset + count; i += 3) {
+                auto const &a = vertices[indices[i]].position;
+                auto const &b = vertices[indices[i + 1]].position;
+                auto const &c = vertices[indices[i + 2]].position;
+                float e1[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+                float e2[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+                std::array<float, 3> n = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+                float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                if (length <= 0.0f)
+                    continue;
+                for (auto &value : n)
+                    value /= length;
+                normals.push_back(n);
+                for (int k = 0; k < 3; k++)
+                    axis[k] += n[k];
+            }
+
+            float axisLength = std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]);
+            if (axisLength > 0.0f && !normals.empty()) {
+                for (auto &value : axis)
+                    value /= axisLength;
+                float minDot = 1.0f;
+                for (auto const &n : normals)
+                    minDot = std::min(minDot, n[0] * axis[0] + n[1] * axis[1] + n[2] * axis[2]);
+                meshlet.coneAxis = axis;
+                /* Cones wider than ~84 degrees are not worth testing */
+                if (minDot > 0.1f)
+                    meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+            }
+            _meshlets.push_back(meshlet);
+        }
+
+        bool isVisible(Meshlet const &meshlet, Frustum const &frustum, bool coneCulling) const {
+            if (!frustum.intersectsSphere(meshlet.center, meshlet.radius))
+                return false;
+            if (!coneCulling || meshlet.coneCutoff > 1.0f)
+                return true;
+
+            auto const &eye = frustum.getEye();
+            float toCenter[3] = {meshlet.center[0] - eye[0], meshlet.center[1] - eye[1], meshlet.center[2] - eye[2]};
+            float distance = std::sqrt(toCenter[0] * toCenter[0] + toCenter[1] * toCenter[1] + toCenter[2] * toCenter[2]);
+            float along = toCenter[0] * meshlet.coneAxis[0] + toCenter[1] * meshlet.coneAxis[1] + toCenter[2] * meshlet.coneAxis[2];
+            return along < meshlet.coneCutoff * distance + meshlet.radius;
+        }
+
+        void cullRange(Frustum const &frustum, bool coneCulling, HiZBuffer const *occlusion, std::vector<size_t> const &candidates,
+            size_t first, size_t last, std::vector<DrawRange> &ranges) const {
+            for (size_t i = first; i < last; i++) {
+                Meshlet const &meshlet = _meshlets[candidates[i] & ~WHOLE_BIT];
+                if (!(candidates[i] & WHOLE_BIT) && (!isVisible(meshlet, frustum, coneCulling)
+                    || (occlusion && occlusion->isOccluded(meshlet.center, meshlet.radius))))
+                    continue;
+                append(ranges, {meshlet.drawIndex, meshlet.indexOffset, meshlet.indexCount});
+            }
+        }
+
+        static void append(std::vector<DrawRange> &ranges, DrawRange const &range) {
+            if (!ranges.empty()) {
+                DrawRange &last = ranges.back();
+                if (last.drawIndex == range.drawIndex && last.indexOffset + last.indexCount == range.indexOffset) {
+                    last.indexCount += range.indexCount;
+                    return;
+                }
+            }
+            ranges.push_back(range);
+        }
+};
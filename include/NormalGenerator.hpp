@@ -0,0 +1,82 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+#include <array>
+#include <cmath>
+#include <algorithm>
+
+#include "MeshVertex.hpp"
+#include "Parallel.hpp"
+
+/* Angle-weighted vertex normals for meshes without `vn`.
+ * Smoothing groups are honored upstream: Mesh only shares a vertex between faces of the same
+ * smoothing group, so accumulating over shared vertices never smooths across a group boundary.
+ * Triangles are split between threads, each accumulating into its own buffer, and the buffers
+ * are then reduced per vertex range, so no synchronization is needed besides the joins. */
+class NormalGenerator {
+    public:
+        /* Below this many triangles, threads cost more than they save */
+        static constexpr size_t PARALLEL_THRESHOLD = 16384;
+
+        /* Fill the normal of every vertex flagged in `generate`, using the triangles in `indices` */
+        static void generate(std::vector<MeshVertex> &vertices, std::vector<GLuint> const &indices, std::vector<bool> const &generate) {
+            size_t triangleCount = indices.size() / 3;
+            size_t workers = Parallel::workerCount(triangleCount, PARALLEL_THRESHOLD);
+            std::vector<std::vector<std::array<float, 3>>> sums(workers, std::vector<std::array<float, 3>>(vertices.size(), {0.0f, 0.0f, 0.0f}));
+
+            Parallel::forRanges(workers, triangleCount, [&](size_t worker, size_t first, size_t last) {
+                for (size_t t = first; t < last; t++)
+                    accumulate(vertices, &indices[t * 3], generate, sums[worker]);
+            });
+
+            Parallel::forRanges(workers, vertices.size(), [&](size_t, size_t first, size_t last) {
+                for (size_t v = first; v < last; v++) {
+                    if (!generate[v])
+                        continue;
+                    std::array<float, 3> n = {0.0f, 0.0f, 0.0f};
+                    for (auto const &sum : sums)
+                        for (int k = 0; k < 3; k++)
+                            n[k] += sum[v][k];
+                    float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                    vertices[v].normal = length > 0.0f ? std::array<float, 3>{n[0] / length, n[1] / length, n[2] / length}
+                                                       : std::array<float, 3>{0.0f, 0.0f, 1.0f};
+                }
+            });
+        }
+
+    private:
+        /* Add the unit face normal weighted by the corner angle to each flagged corner */
+        static void accumulate(std::vector<MeshVertex> const &vertices, GLuint const *triangle, std::vector<bool> const &generate,
+            std::vector<std::array<float, 3>> &sums) {
+            if (!generate[triangle[0]] && !generate[triangle[1]] && !generate[triangle[2]])
+                return;
+
+            std::array<float, 3> p[3];
+            for (int k = 0; k < 3; k++)
+                p[k] = {vertices[triangle[k]].position[0], vertices[triangle[k]].position[1], vertices[triangle[k]].position[2]};
+
+            float e1[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+            float e2[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+            float n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+            float length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if (length <= 0.0f)
+                return;
+
+            for (int k = 0; k < 3; k++) {
+                if (!generate[triangle[k]])
+                    continue;
+                auto const &a = p[k], &b = p[(k + 1) % 3], &c = p[(k + 2) % 3];
+                float u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+                float v[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+                float lengths = std::sqrt((u[0] * u[0] + u[1] * u[1] + u[2] * u[2]) * (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]));
+                if (lengths <= 0.0f)
+                    continue;
+                float cosine = std::clamp((u[0] * v[0] + u[1] * v[1] + u[2] * v[2]) / lengths, -1.0f, 1.0f);
+                float weight = std::acos(cosine) / length;
+                auto &sum = sums[triangle[k]];
+                for (int axis = 0; axis < 3; axis++)
+                    sum[axis] += n[axis] * weight;
+            }
+        }
+};
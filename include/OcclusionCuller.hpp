@@ -0,0 +1,170 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <iostream>
+#include <array>
+#include <vector>
+#include <algorithm>
+
+#include "Matrix.hpp"
+#include "HiZBuffer.hpp"
+#include "DepthRasterizer.hpp"
+
+/* Occlusion culling against a hierarchical depth buffer, see HiZBuffer.
+ * In GPU mode the depth of the opaque pass is read back into a ring of pixel buffers and turned
+ * into a pyramid once its fence signals, a frame or two later, so draws are tested against what
+ * was visible with the matrices of that frame. Until a readback is available, and in CPU mode,
+ * the depth comes from a conservative software rasterization of the frustum-visible draws at a
+ * quarter of the viewport resolution, see DepthRasterizer.
+ * Culling with an older view can hide parts that just became visible: isStale() tells the
+ * caller to draw again until the depth matches the current view. */
+class OcclusionCuller {
+    public:
+        enum Mode { GPU, CPU };
+
+        static constexpr size_t READBACK_FRAMES = 3;
+
+        explicit OcclusionCuller(Mode mode) : _mode(mode) {
+            if (_mode == GPU)
+                for (auto &readback : _readbacks)
+                    glGenBuffers(1, &readback.buffer);
+        }
+        ~OcclusionCuller() {
+            if (_mode != GPU)
+                return;
+            for (auto &readback : _readbacks) {
+                if (readback.fence)
+                    glDeleteSync(readback.fence);
+                glDeleteBuffers(1, &readback.buffer);
+            }
+        }
+        OcclusionCuller(OcclusionCuller const &) = delete;
+        OcclusionCuller &operator=(OcclusionCuller const &) = delete;
+
+        /* The pyramid to cull this frame with, or null when the depth has to be rasterized first */
+        HiZBuffer const *prepare(Matrix const &clip) {
+            _frames++;
+            if (_mode == GPU)
+                collect();
+            _usedReadback = _mode == GPU && _readbackDepth.isValid();
+            _stale = _usedReadback && !sameMatrix(_readbackDepth.getClip(), clip);
+            if (_usedReadback) {
+                _readbackFrames++;
+                return &_readbackDepth;
+            }
+            return nullptr;
+        }
+
+        /* Software depth for this frame, sized for the current viewport: clear, draw the occluders, then finish */
+        DepthRasterizer &beginRasterization(Matrix const &clip) {
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            _rasterizer.clear(clip, viewport[2], viewport[3]);
+            return _rasterizer;
+        }
+        HiZBuffer const &finishRasterization(Matrix const &clip) {
+            float scale = 1.0f / DepthRasterizer::SAMPLE_GRID;
+            _rasterizedDepth.build(_rasterizer.getDepth(), _rasterizer.getWidth(), _rasterizer.getHeight(), clip,
+                {_rasterizer.getViewportWidth() * scale, _rasterizer.getViewportHeight() * scale});
+            return _rasterizedDepth;
+        }
+
+        /* Read back the depth of the opaque pass from the bound framebuffer, without waiting for it */
+        void capture(Matrix const &clip) {
+            if (_mode != GPU)
+                return;
+            Readback &readback = _readbacks[_next];
+            if (readback.fence)
+                return;
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            size_t size = static_cast<size_t>(viewport[2]) * viewport[3] * sizeof(float);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+            if (size != readback.size) {
+                glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ);
+                readback.size = size;
+            }
+            glReadPixels(viewport[0], viewport[1], viewport[2], viewport[3], GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            readback.clip = clip;
+            readback.width = viewport[2];
+            readback.height = viewport[3];
+            readback.generation = _generation;
+            readback.sequence = ++_sequence;
+            _next = (_next + 1) % READBACK_FRAMES;
+        }
+
+        /* Forget the depth of the previous mesh, it says nothing about the new one */
+        void invalidate() {
+            _generation++;
+            _readbackDepth = HiZBuffer();
+        }
+
+        /* The last cull used depth rendered with another view */
+        bool isStale() const { return _stale; }
+
+        void count(size_t tested, size_t culled) {
+            _testedDraws += tested;
+            _culledDraws += culled;
+        }
+
+        void report() const {
+            if (!_frames)
+                return;
+            std::cout << "Occlusion culling: " << _culledDraws << " of " << _testedDraws << " draws culled over " << _frames
+                << " frames, " << _readbackFrames << " from GPU depth, " << _frames - _readbackFrames << " rasterized" << std::endl;
+        }
+
+    private:
+        struct Readback {
+            GLuint buffer = 0;
+            GLsync fence = nullptr;
+            size_t size = 0;
+            Matrix clip;
+            int width = 0, height = 0;
+            unsigned generation = 0;
+            unsigned long sequence = 0;
+        };
+
+        Mode _mode;
+        DepthRasterizer _rasterizer;
+        HiZBuffer _readbackDepth, _rasterizedDepth;
+        std::array<Readback, READBACK_FRAMES> _readbacks;
+        size_t _next = 0;
+        unsigned _generation = 0;
+        unsigned long _sequence = 0, _readbackSequence = 0;
+        bool _usedReadback = false, _stale = false;
+        unsigned long _frames = 0, _readbackFrames = 0;
+        size_t _testedDraws = 0, _culledDraws = 0;
+
+        /* Build the pyramid from the newest finished readback of the current mesh */
+        void collect() {
+            Readback *newest = nullptr;
+            for (auto &readback : _readbacks) {
+                if (!readback.fence || glClientWaitSync(readback.fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+                    continue;
+                glDeleteSync(readback.fence);
+                readback.fence = nullptr;
+                if (readback.generation == _generation && readback.sequence > _readbackSequence
+                    && (!newest || readback.sequence > newest->sequence))
+                    newest = &readback;
+            }
+            if (!newest)
+                return;
+
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, newest->buffer);
+            auto *data = static_cast<float const *>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, newest->size, GL_MAP_READ_BIT));
+            if (data) {
+                std::vector<float> depth(data, data + newest->size / sizeof(float));
+                glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+                _readbackDepth.build(std::move(depth), newest->width, newest->height, newest->clip);
+                _readbackSequence = newest->sequence;
+            }
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        }
+
+        static bool sameMatrix(Matrix const &a, Matrix const &b) {
+            return std::equal(a.get_data(), a.get_data() + 16, b.get_data());
+        }
+};
@@ -0,0 +1,170 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include <array>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <limits>
+
+/* Translation applied to every group of one object of the obj file */
+struct ObjectOffset {
+    std::string object;
+    std::array<float, 3> offset;
+};
+
+/* Command line: <obj file> [<texture file>] [--flag value...] */
+struct Options {
+    static constexpr size_t MAX_INSTANCES = 1000000; // 64 MB of transforms per streamed frame
+
+    std::string objPath;
+    std::string texturePath = "assets/textures/wood.bmp";
+    size_t instanceCount = 0;
+    bool coneCulling = false;
+    float lodThreshold = 1.0f;
+    bool watch = false;
+    bool onDemand = false;
+    float maxFps = 0.0f;
+    int swapInterval = 1;
+    size_t textureBudget = 0; // Bytes, 0 for no limit
+    std::string depthPrepass = "auto"; // auto, on or off
+    float overdrawThreshold = 2.0f;
+    std::string occlusion = "off"; // off, gpu or cpu
+    std::string recordPath;
+    std::string replayPath;
+    size_t replayFrames = 0; // 0 replays the recording once
+    std::string dumpDirectory;
+    std::string goldenDirectory;
+    bool updateGolden = false;
+    float goldenPsnr = 40.0f;
+    std::vector<ObjectOffset> objectOffsets;
+
+    Options(int argc, char **argv) {
+        std::vector<std::string> positional;
+
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            if (arg.rfind("--", 0) != 0) {
+                positional.push_back(arg);
+                continue;
+            }
+
+            if (arg == "--instances")
+                instanceCount = count(value(argc, argv, i), arg, 1, MAX_INSTANCES);
+            else if (arg == "--cone-culling")
+                coneCulling = true;
+            else if (arg == "--watch")
+                watch = true;
+            else if (arg == "--on-demand")
+                onDemand = true;
+            else if (arg == "--max-fps")
+                maxFps = std::stof(value(argc, argv, i));
+            else if (arg == "--swap-interval")
+                swapInterval = std::stoi(value(argc, argv, i));
+            else if (arg == "--texture-budget")
+                textureBudget = count(value(argc, argv, i), arg, 0, std::numeric_limits<size_t>::max() >> 20) << 20;
+            else if (arg == "--depth-prepass") {
+                depthPrepass = value(argc, argv, i);
+                if (depthPrepass != "auto" && depthPrepass != "on" && depthPrepass != "off")
+                    throw std::invalid_argument("Expected auto, on or off for --depth-prepass");
+            } else if (arg == "--occlusion") {
+                occlusion = value(argc, argv, i);
+                if (occlusion != "off" && occlusion != "gpu" && occlusion != "cpu")
+                    throw std::invalid_argument("Expected off, gpu or cpu for --occlusion");
+            } else if (arg == "--record")
+                recordPath = value(argc, argv, i);
+            else if (arg == "--replay")
+                replayPath = value(argc, argv, i);
+            else if (arg == "--frames")
+                replayFrames = std::stoul(value(argc, argv, i));
+            else if (arg == "--dump-frames")
+                dumpDirectory = value(argc, argv, i);
+            else if (arg == "--golden")
+                goldenDirectory = value(argc, argv, i);
+            else if (arg == "--update-golden")
+                updateGolden = true;
+            else if (arg == "--golden-psnr")
+                goldenPsnr = std::stof(value(argc, argv, i));
+            else if (arg == "--overdraw-threshold")
+                overdrawThreshold = std::stof(value(argc, argv, i));
+            else if (arg == "--lod-error")
+                lodThreshold = std::stof(value(argc, argv, i));
+            else if (arg == "--object-offset")
+                objectOffsets.push_back(objectOffset(value(argc, argv, i)));
+            else
+                throw std::invalid_argument("Unknown option: " + arg);
+        }
+
+        if (updateGolden && goldenDirectory.empty())
+            throw std::invalid_argument("--update-golden needs --golden <dir>");
+        if (!recordPath.empty() && !replayPath.empty())
+            throw std::invalid_argument("--record and --replay cannot be combined");
+        if (positional.empty() || positional.size() > 2)
+            throw std::invalid_argument("Expected an obj file and an optional texture file");
+        objPath = positional[0];
+        if (positional.size() == 2)
+            texturePath = positional[1];
+    }
+
+    static std::string usage(const char *name) {
+        return std::string("Usage: ") + name + " <obj file> [<texture file>] [options]\n"
+            "  --instances <n>    draw n instanced copies of the mesh laid out on a grid, 1 to 1000000\n"
+            "  --cone-culling     skip back-facing meshlets (closed, consistently wound meshes only)\n"
+            "  --lod-error <px>   screen-space error allowed when picking a level of detail (default 1, 0 disables)\n"
+            "  --watch            reload the obj, materials, texture and shaders when they change on disk\n"
+            "  --on-demand        only redraw when the view changes, sleeping while idle\n"
+            "  --max-fps <n>      cap the frame rate (default 0, uncapped)\n"
+            "  --swap-interval <n> 0 disables vsync, 1 enables it (default), -1 adaptive vsync where supported\n"
+            "  --texture-budget <MiB> memory for resident textures, least recently used ones are evicted (default 0, no limit)\n"
+            "  --depth-prepass <auto|on|off> lay down depth before shading; auto enables it while overdraw is high (default auto)\n"
+            "  --overdraw-threshold <x> shaded fragments per visible pixel above which auto enables the pre-pass (default 2)\n"
+            "  --occlusion <off|gpu|cpu> skip draws and meshlets hidden in the previous frame's depth (gpu) or a software depth buffer (cpu) (default off)\n"
+            "  --record <file>    log the input events and the state of every drawn frame\n"
+            "  --replay <file>    draw the recorded frames as fast as possible, then print frame time statistics and exit\n"
+            "  --frames <n>       number of frames to replay, looping over the recording (default: its length)\n"
+            "  --dump-frames <dir> save every replayed frame as a BMP file in dir\n"
+            "  --golden <dir>     render the obj, or every obj of a directory, offscreen from fixed cameras, compare with the\n"
+            "                     reference images in dir and exit with an error if any differs\n"
+            "  --update-golden    write the reference images instead of comparing\n"
+            "  --golden-psnr <dB> lowest PSNR accepted against a reference (default 40), <dir>/thresholds.txt overrides it per asset\n"
+            "  --object-offset <object>=<x>,<y>,<z> move one object of the obj file, may be repeated\n"
+            "Drop an obj file on the window to load it in place of the current one";
+    }
+
+    private:
+        static std::string value(int argc, char **argv, int &i) {
+            if (i + 1 >= argc)
+                throw std::invalid_argument(std::string("Missing value for ") + argv[i]);
+            return argv[++i];
+        }
+
+        /* Decimal integer in [min, max]. std::stoul alone wraps "-1" around and ignores trailing text. */
+        static size_t count(std::string const &text, std::string const &option, size_t min, size_t max) {
+            bool valid = !text.empty() && std::all_of(text.begin(), text.end(), [](char c) { return c >= '0' && c <= '9'; });
+            unsigned long long number = 0;
+            try {
+                if (valid)
+                    number = std::stoull(text);
+            } catch (std::out_of_range const &) {
+                valid = false;
+            }
+            if (!valid || number < min || number > max)
+                throw std::invalid_argument("Expected an integer from " + std::to_string(min) + " to " + std::to_string(max) + " for " + option);
+            return static_cast<size_t>(number);
+        }
+
+        /* <object>=<x>,<y>,<z> */
+        static ObjectOffset objectOffset(std::string const &text) {
+            size_t equal = text.rfind('=');
+            if (equal == std::string::npos || equal == 0)
+                throw std::invalid_argument("Expected <object>=<x>,<y>,<z> for --object-offset");
+            ObjectOffset result{text.substr(0, equal), {}};
+            std::istringstream stream(text.substr(equal + 1));
+            char comma1 = 0, comma2 = 0;
+            stream >> result.offset[0] >> comma1 >> result.offset[1] >> comma2 >> result.offset[2];
+            if (!stream || comma1 != ',' || comma2 != ',' || stream.peek() != std::char_traits<char>::eof())
+                throw std::invalid_argument("Expected <object>=<x>,<y>,<z> for --object-offset");
+            return result;
+        }
+};
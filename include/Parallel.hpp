@@ -0,0 +1,31 @@
+#pragma once
+
+#include <vector>
+#include <algorithm>
+
+#include "JobSystem.hpp"
+
+/* Split [0, count) into one contiguous range per worker, run on the job system */
+struct Parallel {
+    /* One worker per `grain` items, capped by the job system threads */
+    static size_t workerCount(size_t count, size_t grain) {
+        return std::max<size_t>(1, std::min(JobSystem::instance().getThreadCount(), count / grain));
+    }
+
+    /* Run task(worker, first, last) for every range and wait for all of them */
+    template <typename Task>
+    static void forRanges(size_t workers, size_t count, Task const &task) {
+        if (workers <= 1) {
+            task(0, 0, count);
+            return;
+        }
+        auto &jobs = JobSystem::instance();
+        std::vector<JobSystem::Handle> handles;
+        size_t chunk = (count + workers - 1) / workers;
+        for (size_t w = 0; w < workers; w++) {
+            size_t first = std::min(count, w * chunk), last = std::min(count, (w + 1) * chunk);
+            handles.push_back(jobs.submit([&task, w, first, last]() { task(w, first, last); }));
+        }
+        jobs.waitAll(handles);
+    }
+};
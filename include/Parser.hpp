@@ -5,33 +5,80 @@
 #include <unordered_map>
 #include <fstream>
 #include <optional>
+#include <deque>
+#include <vector>
+#include <unordered_set>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
 
 #include "objElements/Object.hpp"
 #include "BMP.hpp"
+#include "JobSystem.hpp"
 
 class Parser {
     public:
+        /* The texture is decoded on the job system while the obj is parsed */
         Parser(std::string const &objPath, std::string const &texturePath) {
+            auto &jobs = JobSystem::instance();
+            auto texture = jobs.submit([this, &texturePath]() { parseTexture(texturePath); });
+            try {
+                parseObj(objPath);
+            } catch (...) {
+                try { jobs.wait(texture); } catch (...) {}
+                throw;
+            }
+            jobs.wait(texture);
+        }
+
+        /* Geometry and materials only, used when reloading the obj file */
+        explicit Parser(std::string const &objPath) {
             parseObj(objPath);
-            parseTexture(texturePath);
         }
 
+        /* Material libraries are read on the job system while the body is parsed, usemtl only
+         * interns names, definitions are copied over the interned materials once both are done */
         void parseObj(std::string const &path) {
-            std::ifstream file(path);
+            std::ifstream file(path, std::ios::binary);
             if (!file.is_open()) {
                 std::cerr << "Failed to open file: " << path << std::endl;
                 return;
             }
+            std::string contents;
+            file.seekg(0, std::ios::end);
+            contents.resize(static_cast<size_t>(file.tellg()));
+            file.seekg(0);
+            file.read(&contents[0], contents.size());
+
+            auto &jobs = JobSystem::instance();
+            auto libraries = loadMaterialLibraries(path, contents);
+            try {
+                parseLines(contents);
+            } catch (...) {
+                for (auto const &library : libraries)
+                    try { jobs.wait(library); } catch (...) {}
+                throw;
+            }
+            jobs.waitAll(libraries);
+            localizeObjects();
+            resolveMaterials();
+        }
 
+        void parseLines(std::string const &contents) {
             std::string line;
             size_t lineNb = 1;
             bool vertexDef = false, faceDef = false, lineDef = false;
             std::array<size_t, 3> geometryElemCounts{0, 0, 0};
             Material *currentMaterial = nullptr;
             int currentSmoothingGroup = 0;
-            // std::optional<Material *> mat;
 
-            while (std::getline(file, line)) {
+            for (size_t start = 0; start < contents.size();) {
+                size_t end = contents.find('\n', start);
+                if (end == std::string::npos)
+                    end = contents.size();
+                line.assign(contents, start, end - start);
+                start = end + 1;
+
                 if (line.empty() || line[0] == '#') {
                     lineNb++;
                     continue;
@@ -57,20 +104,20 @@ class Parser {
                         addGeometryElement(tokens, lineNb, NORMAL, vertexDef, faceDef, lineDef);
                         break;
 
-                    case FACE:
-                        if (!faceDef) {
-                            geometryElemCounts[VERTEX_INX] = currentObject->_vertices.size();
-                            geometryElemCounts[TEX_INX] = currentObject->_texCoords.size();
-                            geometryElemCounts[NORMAL_INX] = currentObject->_normals.size();
-                        }
+                    case FACE: {
+                        /* Face indices are global to the file, not to the current object */
+                        geometryElemCounts = elementCounts();
                         checkElemOrder(FACE_TYPE, vertexDef, faceDef, lineDef, lineNb);
                         checkObjExist();
-                        currentObject->addFace(tokens, lineNb, geometryElemCounts, currentMaterial, currentSmoothingGroup);
+                        Face const &face = currentObject->addFace(tokens, lineNb, geometryElemCounts, currentMaterial, currentSmoothingGroup);
+                        checkIndices(face.vertexIndices, _fileVertices.size(), lineNb);
+                        checkIndices(face.textureIndices, _fileTexCoords.size(), lineNb);
+                        checkIndices(face.normalIndices, _fileNormals.size(), lineNb);
                         break;
+                    }
 
                     case LINE:
-                        if (!lineDef)
-                            geometryElemCounts[VERTEX_INX] = currentObject->_vertices.size();
+                        geometryElemCounts = elementCounts();
                         checkElemOrder(LINE_TYPE, vertexDef, faceDef, lineDef, lineNb);
                         checkObjExist();
                         currentObject->addLine(tokens, lineNb, geometryElemCounts[VERTEX_INX]);
@@ -83,8 +130,8 @@ class Parser {
                         }
                         _objects.emplace(tokens[1], Object(tokens[1]));
                         currentObject = &_objects[tokens[1]];
-                        vertexDef = faceDef = false;
-                        geometryElemCounts = {0, 0, 0};
+                        /* Vertices declared under earlier objects stay usable */
+                        faceDef = false;
                         break;
 
                     case GROUP:
@@ -110,11 +157,7 @@ class Parser {
                         break;
 
                     case MATLIB:
-                        if (tokens.size() != 2) {
-                            std::cerr << "Invalid material library format on line " << lineNb << std::endl;
-                            throw std::exception();
-                        }
-                        // _materialLibraries.emplace_back(path, tokens[1]);
+                        /* Already loading, see loadMaterialLibraries */
                         break;
 
                     case USEMTL:
@@ -122,12 +165,7 @@ class Parser {
                             std::cerr << "Invalid material name format on line " << lineNb << std::endl;
                             throw std::exception();
                         }
-                        // mat = materialExists(tokens[1]);
-                        // if (!mat.has_value()) {
-                        //     std::cerr << "Material " << tokens[1] << " does not exist on line " << lineNb << std::endl;
-                        //     throw std::exception();
-                        // }
-                        // currentMaterial = mat.value();
+                        currentMaterial = &_materials[internMaterial(tokens[1], lineNb)];
                         break;
                     case UNKNOWN:
                         std::cerr << "Unknown prefix: " << tokens[0] << " on line " << lineNb << std::endl;
@@ -141,39 +179,58 @@ class Parser {
         }
 
         void parseTexture(std::string const &path) {
+            _texture = readTexture(path);
+        }
+
+        /* Largest side accepted; textures above GL_MAX_TEXTURE_SIZE are streamed from a smaller mip level */
+        static constexpr unsigned MAX_TEXTURE_SIZE = 16384;
+
+        /* Dimensions from the header alone, false when the file is not a BMP this decoder reads */
+        static bool readTextureSize(std::string const &path, unsigned &width, unsigned &height) {
+            std::ifstream binaryFile(path, std::ios::binary);
+            auto header = readTextureHeader(binaryFile);
+            if (!header)
+                return false;
+            width = header->width;
+            height = header->height;
+            return true;
+        }
+
+        /* Decode a 24 bits BMP file, safe to call from any thread */
+        static BMP readTexture(std::string const &path) {
+            BMP texture;
             std::ifstream binaryFile(path, std::ios::binary);
             if (!binaryFile.is_open())
                 throw std::runtime_error("Failed to open texture file");
 
-            /* BMP header is 54 bits */
-            unsigned char header[54];
-            binaryFile.read(reinterpret_cast<char*>(header), 54);
-
-            if (header[0] != 'B' || header[1] != 'M')
-                throw std::runtime_error("Not a BMP file");
-
-            /* Extract width and height from header */ 
-            _texture.width = *(reinterpret_cast<unsigned int*>(&header[18]));
-            _texture.height = *(reinterpret_cast<unsigned int*>(&header[22]));
+            auto header = readTextureHeader(binaryFile);
+            if (!header)
+                throw std::runtime_error("Not an uncompressed 24 bits BMP file of a supported size");
+            texture.width = header->width;
+            texture.height = header->height;
 
             /* Calculate the padding added to each row */ 
-            int row_padded = (_texture.width * 3 + 3) & (~3);
-
-            _texture.data.resize(_texture.width * _texture.height * 3);
-            unsigned char* pixel_data = new unsigned char[row_padded];
-
-            for (unsigned int y = 0; y < _texture.height; ++y) {
-                binaryFile.read(reinterpret_cast<char*>(pixel_data), row_padded);
-                for (unsigned int x = 0; x < _texture.width; ++x) {
-                    unsigned long idx = (x + y * _texture.width) * 3;
+            size_t row_padded = (static_cast<size_t>(texture.width) * 3 + 3) & (~size_t(3));
+
+            texture.data.resize(static_cast<size_t>(texture.width) * texture.height * 3);
+            std::vector<unsigned char> pixel_data(row_padded);
+
+            binaryFile.seekg(header->dataOffset);
+            for (unsigned int y = 0; y < texture.height; ++y) {
+                if (!binaryFile.read(reinterpret_cast<char*>(pixel_data.data()), row_padded))
+                    throw std::runtime_error("Truncated BMP file");
+                /* Rows are kept bottom up */
+                unsigned int row = header->topDown ? texture.height - 1 - y : y;
+                for (unsigned int x = 0; x < texture.width; ++x) {
+                    size_t idx = (x + static_cast<size_t>(row) * texture.width) * 3;
                     /* RGB */
-                    _texture.data[idx + 2] = pixel_data[x * 3 + 0];
-                    _texture.data[idx + 1] = pixel_data[x * 3 + 1];
-                    _texture.data[idx + 0] = pixel_data[x * 3 + 2];
+                    texture.data[idx + 2] = pixel_data[x * 3 + 0];
+                    texture.data[idx + 1] = pixel_data[x * 3 + 1];
+                    texture.data[idx + 0] = pixel_data[x * 3 + 2];
                 }
             }
-            delete[] pixel_data;
             binaryFile.close();
+            return texture;
         }
 
         std::unordered_map<std::string, Object> const &getObjects() const { return _objects; }
@@ -195,11 +252,46 @@ class Parser {
 
         BMP &getTexture() { return _texture; }
 
+        std::vector<std::string> getMaterialLibraryPaths() const {
+            std::vector<std::string> paths;
+            for (auto const &m : _materialLibraries)
+                if (std::find(paths.begin(), paths.end(), m._path) == paths.end())
+                    paths.push_back(m._path);
+            return paths;
+        }
+
+        /* Parse the library again and copy the new values over the interned materials, so the
+         * pointers held by faces and meshes stay valid. Returns false when materials were added
+         * or removed, which needs the obj to be reloaded instead. */
+        bool reloadMaterialLibrary(std::string const &path) {
+            MTL reloaded("", path);
+            auto names = [](MTL const &library) {
+                std::vector<std::string> result;
+                for (auto const &material : library._materials)
+                    result.push_back(material._name);
+                std::sort(result.begin(), result.end());
+                return result;
+            };
+            for (auto &m : _materialLibraries)
+                if (m._path == path && names(m) != names(reloaded))
+                    return false;
+            for (auto &m : _materialLibraries)
+                if (m._path == path)
+                    m._materials = reloaded._materials;
+            applyMaterialLibraries();
+            return true;
+        }
+
     private:
         Parser() {}
 
         std::unordered_map <std::string, Object> _objects;
         std::vector<MTL> _materialLibraries;
+        /* Indexed by interned id, std::deque keeps Face::material pointers valid while names are added */
+        std::deque<Material> _materials;
+        std::unordered_map<std::string, size_t> _materialIds;
+        /* Line of the first usemtl of each id, 0 for names only seen in a library */
+        std::vector<size_t> _materialFirstUse;
         BMP _texture;
 
         void checkObjExist() {
@@ -235,20 +327,163 @@ class Parser {
             checkElemOrder(VERTEX_TYPE, vertexDef, faceDef, lineDef, lineNb);
             checkObjExist();
             if (elemType == VERTEX)
-                currentObject->_vertices.emplace_back(tokens, lineNb);
+                _fileVertices.emplace_back(tokens, lineNb);
             else if (elemType == TEXCOORD)
-                currentObject->_texCoords.emplace_back(tokens, lineNb);
+                _fileTexCoords.emplace_back(tokens, lineNb);
             else
-                currentObject->_normals.emplace_back(tokens, lineNb);
+                _fileNormals.emplace_back(tokens, lineNb);
+        }
+
+        std::array<size_t, 3> elementCounts() const {
+            return {_fileVertices.size(), _fileTexCoords.size(), _fileNormals.size()};
         }
 
-        std::optional<Material *> materialExists(std::string const &name) {
-            for (auto &m : _materialLibraries) {
-                if (m._materials.find(name) != m._materials.end())
-                    return &m._materials.at(name);
+        static void checkIndices(std::vector<int> const &indices, size_t count, size_t lineNb) {
+            for (int index : indices)
+                if (index < 0 || static_cast<size_t>(index) >= count)
+                    throw std::runtime_error("Error parsing face element: index out of range. line: " + std::to_string(lineNb));
+        }
+
+        /* Give every object a copy of the elements its faces use, in order of first use, and
+         * renumber the faces to match. Faces may use elements declared under any earlier object. */
+        void localizeObjects() {
+            /* File index -> (object the entry was set for, index in that object) */
+            std::vector<std::pair<size_t, int>> vertexRemap(_fileVertices.size(), {0, 0});
+            std::vector<std::pair<size_t, int>> texCoordRemap(_fileTexCoords.size(), {0, 0});
+            std::vector<std::pair<size_t, int>> normalRemap(_fileNormals.size(), {0, 0});
+            size_t stamp = 0;
+            for (auto &objectPair : _objects) {
+                Object &object = objectPair.second;
+                stamp++;
+                for (auto &groupPair : object._groups) {
+                    for (auto &face : groupPair.second.faces) {
+                        localize(face.vertexIndices, _fileVertices, object._vertices, vertexRemap, stamp);
+                        localize(face.textureIndices, _fileTexCoords, object._texCoords, texCoordRemap, stamp);
+                        localize(face.normalIndices, _fileNormals, object._normals, normalRemap, stamp);
+                    }
+                }
+            }
+            _fileVertices = {};
+            _fileTexCoords = {};
+            _fileNormals = {};
+        }
+
+        template <typename Element>
+        static void localize(std::vector<int> &indices, std::vector<Element> const &file, std::vector<Element> &local,
+            std::vector<std::pair<size_t, int>> &remap, size_t stamp) {
+            for (auto &index : indices) {
+                auto &target = remap[index];
+                if (target.first != stamp) {
+                    target = {stamp, static_cast<int>(local.size())};
+                    local.push_back(file[index]);
+                }
+                index = target.second;
+            }
+        }
+
+        size_t internMaterial(std::string const &name, size_t lineNb) {
+            auto it = _materialIds.find(name);
+            if (it != _materialIds.end())
+                return it->second;
+            _materialIds.emplace(name, _materials.size());
+            _materials.emplace_back(name);
+            _materialFirstUse.push_back(lineNb);
+            return _materials.size() - 1;
+        }
+
+        /* mtllib statements are collected with a quick scan before the body is parsed, so every
+         * library is parsed concurrently with the geometry instead of serially when reached */
+        std::vector<JobSystem::Handle> loadMaterialLibraries(std::string const &objPath, std::string const &contents) {
+            std::vector<std::string> names;
+            for (size_t start = 0; start < contents.size();) {
+                size_t end = contents.find('\n', start);
+                if (end == std::string::npos)
+                    end = contents.size();
+                size_t first = contents.find_first_not_of(' ', start);
+                if (first < end && contents.compare(first, 7, "mtllib ") == 0) {
+                    auto tokens = split(contents.substr(first, end - first), ' ');
+                    for (size_t i = 1; i < tokens.size(); i++)
+                        if (std::find(names.begin(), names.end(), tokens[i]) == names.end())
+                            names.push_back(tokens[i]);
+                }
+                start = end + 1;
             }
-            return std::nullopt;
+
+            _materialLibraries.resize(names.size());
+            std::vector<JobSystem::Handle> handles;
+            for (size_t i = 0; i < names.size(); i++)
+                handles.push_back(JobSystem::instance().submit([this, i, &objPath, name = names[i]]() {
+                    _materialLibraries[i] = MTL(objPath, name);
+                }));
+            return handles;
+        }
+
+        /* Copy the definitions over the interned materials, the first library defining a name wins.
+         * Returns which ids have a definition. */
+        std::vector<bool> applyMaterialLibraries() {
+            std::vector<bool> defined(_materials.size(), false);
+            for (auto const &library : _materialLibraries)
+                for (auto const &material : library._materials) {
+                    size_t id = internMaterial(material._name, 0);
+                    if (id >= defined.size())
+                        defined.resize(id + 1, false);
+                    if (!defined[id]) {
+                        _materials[id] = material;
+                        defined[id] = true;
+                    }
+                }
+            return defined;
+        }
+
+        /* Faces using a name no library defines are drawn with the default material */
+        void resolveMaterials() {
+            std::vector<bool> defined = applyMaterialLibraries();
+            std::unordered_set<Material const *> missing;
+            for (size_t id = 0; id < _materials.size(); id++) {
+                if (defined[id])
+                    continue;
+                std::cerr << "Material " << _materials[id]._name << " does not exist on line " << _materialFirstUse[id] << ", using default material" << std::endl;
+                missing.insert(&_materials[id]);
+            }
+            if (missing.empty())
+                return;
+            for (auto &object : _objects)
+                for (auto &group : object.second._groups)
+                    for (auto &face : group.second.faces)
+                        if (missing.count(face.material))
+                            face.material = nullptr;
+        }
+
+        struct TextureHeader {
+            unsigned width, height;
+            unsigned dataOffset; // Of the first row
+            bool topDown;        // Negative height in the file
+        };
+
+        /* Fields of the 54 bytes header, little endian. Sizes are checked before they are used to
+         * allocate or to size the texture array. */
+        static std::optional<TextureHeader> readTextureHeader(std::istream &file) {
+            unsigned char header[54];
+            if (!file.read(reinterpret_cast<char*>(header), 54) || header[0] != 'B' || header[1] != 'M')
+                return std::nullopt;
+            auto get = [&header](int offset, int size) {
+                uint32_t value = 0;
+                for (int k = 0; k < size; k++)
+                    value |= static_cast<uint32_t>(header[offset + k]) << (k * 8);
+                return value;
+            };
+            int32_t width = static_cast<int32_t>(get(18, 4)), height = static_cast<int32_t>(get(22, 4));
+            uint32_t bitsPerPixel = get(28, 2), compression = get(30, 4), dataOffset = get(10, 4);
+            if (bitsPerPixel != 24 || compression != 0 || dataOffset < 54 || width <= 0 || height == 0
+                || height == INT32_MIN || static_cast<unsigned>(width) > MAX_TEXTURE_SIZE
+                || static_cast<unsigned>(std::abs(height)) > MAX_TEXTURE_SIZE)
+                return std::nullopt;
+            return TextureHeader{static_cast<unsigned>(width), static_cast<unsigned>(std::abs(height)), dataOffset, height < 0};
         }
 
         Object *currentObject = nullptr;
+        /* v, vt and vn of the whole file, which face indices refer to until localizeObjects() */
+        std::vector<Vertex> _fileVertices;
+        std::vector<TexCoord> _fileTexCoords;
+        std::vector<Normal> _fileNormals;
 };
\ No newline at end of file
@@ -0,0 +1,138 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <iterator>
+#include <iostream>
+#include <functional>
+#include <cstdlib>
+#include <cstdint>
+#include <cerrno>
+#include <sys/stat.h>
+
+/* Linked programs saved with glGetProgramBinary, one file per program.
+ * The key covers both sources and the vendor, renderer and version strings, and is stored
+ * in the file so a hash collision or a driver update falls back to compiling from source,
+ * as does a binary the driver refuses. */
+class ProgramCache {
+    public:
+        /* Program linked from the cached binary for these sources, or 0 */
+        static GLuint load(std::string const &vertexSource, std::string const &fragmentSource) {
+            if (!isSupported())
+                return 0;
+            std::string key = makeKey(vertexSource, fragmentSource);
+            std::ifstream file(path(key), std::ios::binary);
+            if (!file.is_open())
+                return 0;
+
+            uint32_t magic = 0, keySize = 0;
+            GLenum format = 0;
+            file.read(reinterpret_cast<char *>(&magic), sizeof(magic));
+            file.read(reinterpret_cast<char *>(&keySize), sizeof(keySize));
+            if (!file || magic != MAGIC || keySize != key.size())
+                return 0;
+            std::string storedKey(keySize, '\0');
+            file.read(&storedKey[0], keySize);
+            file.read(reinterpret_cast<char *>(&format), sizeof(format));
+            if (!file || storedKey != key)
+                return 0;
+            std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+            GLuint program = glCreateProgram();
+            glProgramBinary(program, format, binary.data(), static_cast<GLsizei>(binary.size()));
+            GLint success = GL_FALSE;
+            glGetProgramiv(program, GL_LINK_STATUS, &success);
+            if (!success) {
+                glDeleteProgram(program);
+                return 0;
+            }
+            return program;
+        }
+
+        /* Call before linking so the driver keeps the binary around */
+        static void prepare(GLuint program) {
+            if (isSupported())
+                glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        }
+
+        static void store(std::string const &vertexSource, std::string const &fragmentSource, GLuint program) {
+            if (!isSupported())
+                return;
+            GLint size = 0;
+            glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &size);
+            if (size <= 0)
+                return;
+            std::vector<char> binary(size);
+            GLenum format = 0;
+            glGetProgramBinary(program, size, nullptr, &format, binary.data());
+
+            std::string key = makeKey(vertexSource, fragmentSource);
+            if (!makeDirectory())
+                return;
+            std::ofstream file(path(key), std::ios::binary | std::ios::trunc);
+            if (!file.is_open()) {
+                std::cerr << "Failed to write program cache: " << path(key) << std::endl;
+                return;
+            }
+            uint32_t keySize = static_cast<uint32_t>(key.size());
+            file.write(reinterpret_cast<char const *>(&MAGIC), sizeof(MAGIC));
+            file.write(reinterpret_cast<char const *>(&keySize), sizeof(keySize));
+            file.write(key.data(), key.size());
+            file.write(reinterpret_cast<char const *>(&format), sizeof(format));
+            file.write(binary.data(), binary.size());
+        }
+
+    private:
+        static constexpr uint32_t MAGIC = 0x31504353; // "SCP1"
+
+        static bool isSupported() {
+            static const bool supported = [] {
+                GLint formats = 0;
+                glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+                return formats > 0;
+            }();
+            return supported;
+        }
+
+        static std::string glString(GLenum name) {
+            const GLubyte *value = glGetString(name);
+            return value ? reinterpret_cast<const char *>(value) : "";
+        }
+
+        static std::string makeKey(std::string const &vertexSource, std::string const &fragmentSource) {
+            return glString(GL_VENDOR) + '\n' + glString(GL_RENDERER) + '\n' + glString(GL_VERSION) + '\n'
+                + vertexSource + '\0' + fragmentSource;
+        }
+
+        /* $XDG_CACHE_HOME/scop, ~/.cache/scop, or .cache/scop in the working directory */
+        static std::string directory() {
+            if (const char *xdg = std::getenv("XDG_CACHE_HOME"))
+                return std::string(xdg) + "/scop";
+            if (const char *home = std::getenv("HOME"))
+                return std::string(home) + "/.cache/scop";
+            return ".cache/scop";
+        }
+
+        static bool makeDirectory() {
+            std::string dir = directory();
+            for (size_t pos = dir.find('/', 1); ; pos = dir.find('/', pos + 1)) {
+                std::string partial = dir.substr(0, pos);
+                if (mkdir(partial.c_str(), 0755) != 0 && errno != EEXIST) {
+                    std::cerr << "Failed to create cache directory: " << partial << std::endl;
+                    return false;
+                }
+                if (pos == std::string::npos)
+                    return true;
+            }
+        }
+
+        static std::string path(std::string const &key) {
+            std::ostringstream name;
+            name << directory() << "/" << std::hex << std::setw(16) << std::setfill('0') << std::hash<std::string>()(key) << ".bin";
+            return name.str();
+        }
+};
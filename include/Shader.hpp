@@ -5,87 +5,92 @@
 #include <fstream>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
+#include <map>
 
 #include "Matrix.hpp"
-// #include "BMP.hpp"
+#include "ProgramCache.hpp"
 
+/* Both stages are compiled into one program per combination of features, each feature
+ * turned into a #define so the shaders branch at compile time instead of on uniforms.
+ * Variants are built the first time they are selected and go through the program cache. */
 class Shader {
     public:
-        GLuint _textureId;
+        enum Feature : unsigned {
+            NORMALS = 1u << 0,   // HAS_NORMALS: lighting from the vertex normals
+            TEXTURED = 1u << 1,  // TEXTURED: texture fetched and blended with textureState
+            MATERIALS = 1u << 2, // HAS_MATERIALS: diffuse color from the material table
+            OIT = 1u << 3,       // OIT_PASS: weighted blended transparency outputs, see TransparencyPass
+            INSTANCED = 1u << 4  // INSTANCED: per-instance transforms fetched with gl_InstanceID, see InstanceSet
+        };
+
+        /* Uniform buffer binding point of the FrameData block */
+        static constexpr GLuint FRAME_DATA_BINDING = 0;
 
         Shader(
             const char *vertexPath, 
             const char *fragmentPath, 
-            bool hasNormals, 
-            float *textureState,
-            BMP &texture
-        ) {
-            std::string vertexSource = getFileString(vertexPath);
-            std::string fragmentSource = getFileString(fragmentPath);
-
-            GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
-            GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+            unsigned features
+        ) : _vertexPath(vertexPath), _fragmentPath(fragmentPath) {
+            _vertexSource = getFileString(vertexPath);
+            _fragmentSource = getFileString(fragmentPath);
+            if (!select(features))
+                throw std::runtime_error("Failed to build shader program");
 
-            compileShader(vertexShader, vertexSource.c_str());
-            compileShader(fragmentShader, fragmentSource.c_str());
+            std::cout << "Shader created successfully" << std::endl;
 
-            _id = glCreateProgram();
-            glAttachShader(_id, vertexShader);
-            glAttachShader(_id, fragmentShader);
-            glLinkProgram(_id);
+        }
+        ~Shader() { deleteVariants(); }
+
+        /* Make the variant for these features current, building it if needed. A variant that fails
+         * to build is remembered as such and the current program stays in use. */
+        bool select(unsigned features) {
+            auto it = _variants.find(features);
+            if (it == _variants.end())
+                it = _variants.emplace(features, buildProgram(specialize(_vertexSource, features), specialize(_fragmentSource, features))).first;
+            if (!it->second)
+                return false;
+            _id = it->second;
+            _features = features;
+            glUseProgram(_id);
+            return true;
+        }
 
-            GLint success;
-            GLchar infoLog[512];
-            glGetProgramiv(_id, GL_LINK_STATUS, &success);
-            if (!success) {
-                glGetProgramInfoLog(_id, 512, nullptr, infoLog);
-                std::cerr << "ERROR::SHADER::LINKING_FAILED\n" << infoLog << std::endl;
+        /* Read the shader files again and rebuild the current variant, the others are rebuilt when next
+         * selected. Everything is kept as is if the new sources do not build. */
+        bool reload() {
+            std::string vertexSource, fragmentSource;
+            try {
+                vertexSource = getFileString(_vertexPath.c_str());
+                fragmentSource = getFileString(_fragmentPath.c_str());
+            } catch (std::exception const &) {
+                return false;
             }
-
+            GLuint program = buildProgram(specialize(vertexSource, _features), specialize(fragmentSource, _features));
+            if (!program)
+                return false;
+
+            deleteVariants();
+            _vertexSource = vertexSource;
+            _fragmentSource = fragmentSource;
+            _variants[_features] = program;
+            _id = program;
             glUseProgram(_id);
-
-            GLuint hasNormalsLoc = glGetUniformLocation(_id, "hasNormals");
-            glUniform1i(hasNormalsLoc, hasNormals);
-            GLint textureStateLoc = glGetUniformLocation(_id, "textureStateLoc");
-			glUniform1f(textureStateLoc, *textureState);
-
-            loadTexture(texture);
-
-            glDeleteShader(vertexShader);
-            glDeleteShader(fragmentShader);
-
-            std::cout << "Shader created successfully" << std::endl;
-
+            return true;
         }
-        ~Shader() { glDeleteProgram(_id); }
 
-        void loadTexture(BMP &texture) {
-            glGenTextures(1, &_textureId);
-            glBindTexture(GL_TEXTURE_2D, _textureId);
-
-            /* Set texture parameters */
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);	
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-            /* Upload texture data */
-            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, texture.width, texture.height, 0, GL_RGB, GL_UNSIGNED_BYTE, texture.data.data());
-            glBindTexture(GL_TEXTURE_2D, 0);
-        }
+        std::string const &getVertexPath() const { return _vertexPath; }
+        std::string const &getFragmentPath() const { return _fragmentPath; }
 
         void use() {
             glUseProgram(_id);
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, _textureId);
         }
         GLuint getId() const { return _id; }
 
-        void update(bool hasNormals) {
-            if (hasNormals) {
-                GLuint hasNormalsLoc = glGetUniformLocation(_id, "hasNormals");
-                glUniform1i(hasNormalsLoc, 1);
-            }
+        unsigned getFeatures() const { return _features; }
+
+        void setFloat(const std::string &name, float value) const {
+            glUniform1f(glGetUniformLocation(_id, name.c_str()), value);
         }
 
         void setMat4(const std::string &name, Matrix &mat) const {
@@ -96,12 +101,52 @@ class Shader {
             glUniform3fv(glGetUniformLocation(_id, name.c_str()), 1, vec.data());
         }
 
+        void setVec4(const std::string &name, const std::array<float, 4> &vec) const {
+            glUniform4fv(glGetUniformLocation(_id, name.c_str()), 1, vec.data());
+        }
+
         void setTexture(const std::string &name, int textureUnit) const {
             glUniform1i(glGetUniformLocation(_id, name.c_str()), textureUnit);
         }
-        
+
     private:
-        GLuint _id;
+        GLuint _id = 0;
+        unsigned _features = 0;
+        std::string _vertexPath, _fragmentPath;
+        std::string _vertexSource, _fragmentSource;
+        std::map<unsigned, GLuint> _variants; // 0 for variants that failed to build
+
+        /* Insert the feature defines right after the #version line, keeping the line numbers of the errors */
+        static std::string specialize(std::string const &source, unsigned features) {
+            std::string defines;
+            if (features & NORMALS)
+                defines += "#define HAS_NORMALS\n";
+            if (features & TEXTURED)
+                defines += "#define TEXTURED\n";
+            if (features & MATERIALS)
+                defines += "#define HAS_MATERIALS\n";
+            if (features & OIT)
+                defines += "#define OIT_PASS\n";
+            if (features & INSTANCED)
+                defines += "#define INSTANCED\n";
+            size_t lineEnd = source.find('\n');
+            if (lineEnd == std::string::npos || source.compare(0, 8, "#version") != 0)
+                return defines + "#line 1\n" + source;
+            return source.substr(0, lineEnd + 1) + defines + "#line 2\n" + source.substr(lineEnd + 1);
+        }
+
+        static void bindBlocks(GLuint program) {
+            GLuint frameData = glGetUniformBlockIndex(program, "FrameData");
+            if (frameData != GL_INVALID_INDEX)
+                glUniformBlockBinding(program, frameData, FRAME_DATA_BINDING);
+        }
+
+        void deleteVariants() {
+            for (auto const &variant : _variants)
+                if (variant.second)
+                    glDeleteProgram(variant.second);
+            _variants.clear();
+        }
 
         Shader() {};
         Shader(Shader const &src) = delete;
@@ -122,7 +167,7 @@ class Shader {
             return ss.str();
         }
 
-        void compileShader(GLuint shader, const char *shaderSource) {
+        bool compileShader(GLuint shader, const char *shaderSource) {
             glShaderSource(shader, 1, &shaderSource, nullptr);
             glCompileShader(shader);
 
@@ -133,5 +178,46 @@ class Shader {
                 glGetShaderInfoLog(shader, 512, nullptr, infoLog);
                 std::cerr << "ERROR::SHADER::COMPILATION_FAILED\n" << infoLog << std::endl;
             }
+            return success;
+        }
+
+        /* Load the program from the binary cache, or compile and link both stages and cache the result.
+         * Returns 0 when either step fails */
+        GLuint buildProgram(std::string const &vertexSource, std::string const &fragmentSource) {
+            if (GLuint cached = ProgramCache::load(vertexSource, fragmentSource)) {
+                bindBlocks(cached);
+                return cached;
+            }
+
+            GLuint vertexShader = glCreateShader(GL_VERTEX_SHADER);
+            GLuint fragmentShader = glCreateShader(GL_FRAGMENT_SHADER);
+            bool compiled = compileShader(vertexShader, vertexSource.c_str());
+            compiled = compileShader(fragmentShader, fragmentSource.c_str()) && compiled;
+
+            GLuint program = 0;
+            if (compiled) {
+                program = glCreateProgram();
+                glAttachShader(program, vertexShader);
+                glAttachShader(program, fragmentShader);
+                ProgramCache::prepare(program);
+                glLinkProgram(program);
+
+                GLint success;
+                GLchar infoLog[512];
+                glGetProgramiv(program, GL_LINK_STATUS, &success);
+                if (!success) {
+                    glGetProgramInfoLog(program, 512, nullptr, infoLog);
+                    std::cerr << "ERROR::SHADER::LINKING_FAILED\n" << infoLog << std::endl;
+                    glDeleteProgram(program);
+                    program = 0;
+                } else {
+                    ProgramCache::store(vertexSource, fragmentSource, program);
+                    bindBlocks(program);
+                }
+            }
+
+            glDeleteShader(vertexShader);
+            glDeleteShader(fragmentShader);
+            return program;
         }
 };
\ No newline at end of file
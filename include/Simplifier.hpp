@@ -0,0 +1,287 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+#include <array>
+#include <queue>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <unordered_map>
+#include <string>
+
+#include "MeshVertex.hpp"
+
+/* Quadric error metric simplification (Garland & Heckbert) by half-edge collapse.
+ * A vertex is always collapsed onto one of its neighbours, so the simplified triangles
+ * only reference existing vertices and can share the original vertex buffer.
+ * Vertices sharing a position (uv or normal seams) are collapsed together. */
+class Simplifier {
+    public:
+        /* Simplify `indexCount` indices towards `targetIndexCount`, `error` receives the largest
+         * collapse error as a distance in mesh units */
+        static std::vector<GLuint> simplify(std::vector<MeshVertex> const &vertices, GLuint const *indices, size_t indexCount,
+            size_t targetIndexCount, float &error) {
+            Simplifier simplifier(vertices, indices, indexCount);
+            return simplifier.run(targetIndexCount / 3, error);
+        }
+
+    private:
+        struct Quadric {
+            double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+            static Quadric plane(double a, double b, double c, double d, double weight) {
+                Quadric q;
+                q.a2 = a * a * weight; q.ab = a * b * weight; q.ac = a * c * weight; q.ad = a * d * weight;
+                q.b2 = b * b * weight; q.bc = b * c * weight; q.bd = b * d * weight;
+                q.c2 = c * c * weight; q.cd = c * d * weight;
+                q.d2 = d * d * weight;
+                return q;
+            }
+
+            void add(Quadric const &q) {
+                a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+                b2 += q.b2; bc += q.bc; bd += q.bd;
+                c2 += q.c2; cd += q.cd;
+                d2 += q.d2;
+            }
+
+            double evaluate(std::array<float, 4> const &p) const {
+                double x = p[0], y = p[1], z = p[2];
+                double value = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+                    + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+                    + c2 * z * z + 2 * cd * z + d2;
+                return value > 0.0 ? value : 0.0;
+            }
+        };
+
+        struct Collapse {
+            double cost;
+            uint32_t from, to;
+            uint32_t fromStamp, toStamp;
+
+            bool operator>(Collapse const &rhs) const { return cost > rhs.cost; }
+        };
+
+        /* Boundary edges get a perpendicular plane with this weight so open borders keep their shape */
+        static constexpr double BORDER_WEIGHT = 10.0;
+
+        std::vector<MeshVertex> const &_vertices;
+        std::vector<GLuint> _globals;                   // local vertex -> index in the vertex buffer
+        std::vector<uint32_t> _canonical;               // local vertex -> first local vertex at the same position
+        std::vector<uint32_t> _collapsedTo;             // canonical vertex -> vertex it was merged into (itself if alive)
+        std::vector<std::array<uint32_t, 3>> _triangles;
+        std::vector<bool> _deadTriangles;
+        std::vector<std::vector<uint32_t>> _adjacency;  // canonical vertex -> triangles
+        std::vector<Quadric> _quadrics;
+        std::vector<uint32_t> _stamps;
+        std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> _heap;
+        size_t _aliveTriangles = 0;
+
+        Simplifier(std::vector<MeshVertex> const &vertices, GLuint const *indices, size_t indexCount) : _vertices(vertices) {
+            std::unordered_map<GLuint, uint32_t> locals;
+            std::unordered_map<std::string, uint32_t> positions;
+
+            for (size_t i = 0; i + 2 < indexCount; i += 3) {
+                std::array<uint32_t, 3> triangle;
+                for (size_t k = 0; k < 3; k++) {
+                    GLuint global = indices[i + k];
+                    auto it = locals.find(global);
+                    if (it == locals.end()) {
+                        uint32_t local = static_cast<uint32_t>(_globals.size());
+                        it = locals.emplace(global, local).first;
+                        _globals.push_back(global);
+
+                        std::string key(reinterpret_cast<const char *>(vertices[global].position.data()), sizeof(float) * 3);
+                        auto canonical = positions.emplace(key, local).first->second;
+                        _canonical.push_back(canonical);
+                    }
+                    triangle[k] = it->second;
+                }
+                _triangles.push_back(triangle);
+            }
+
+            _collapsedTo.resize(_globals.size());
+            for (uint32_t v = 0; v < _collapsedTo.size(); v++)
+                _collapsedTo[v] = v;
+            _deadTriangles.assign(_triangles.size(), false);
+            _adjacency.resize(_globals.size());
+            _quadrics.resize(_globals.size());
+            _stamps.assign(_globals.size(), 0);
+
+            std::unordered_map<uint64_t, int> edgeUses;
+            for (uint32_t t = 0; t < _triangles.size(); t++) {
+                auto c = corners(t);
+                if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2]) {
+                    _deadTriangles[t] = true;
+                    continue;
+                }
+                _aliveTriangles++;
+                std::array<double, 4> plane;
+                if (trianglePlane(c, plane)) {
+                    Quadric q = Quadric::plane(plane[0], plane[1], plane[2], plane[3], 1.0);
+                    for (auto v : c)
+                        _quadrics[v].add(q);
+                }
+                for (size_t k = 0; k < 3; k++) {
+                    _adjacency[c[k]].push_back(t);
+                    edgeUses[edgeKey(c[k], c[(k + 1) % 3])]++;
+                }
+            }
+
+            addBorderQuadrics(edgeUses);
+
+            for (uint32_t v = 0; v < _globals.size(); v++)
+                if (_canonical[v] == v)
+                    pushCollapses(v);
+        }
+
+        static uint64_t edgeKey(uint32_t a, uint32_t b) {
+            return a < b ? (uint64_t(a) << 32) | b : (uint64_t(b) << 32) | a;
+        }
+
+        std::array<float, 4> const &position(uint32_t v) const { return _vertices[_globals[v]].position; }
+
+        uint32_t find(uint32_t v) {
+            while (_collapsedTo[v] != v) {
+                _collapsedTo[v] = _collapsedTo[_collapsedTo[v]];
+                v = _collapsedTo[v];
+            }
+            return v;
+        }
+
+        /* Current canonical vertices of a triangle */
+        std::array<uint32_t, 3> corners(uint32_t t) {
+            return {find(_canonical[_triangles[t][0]]), find(_canonical[_triangles[t][1]]), find(_canonical[_triangles[t][2]])};
+        }
+
+        bool trianglePlane(std::array<uint32_t, 3> const &c, std::array<double, 4> &plane) const {
+            auto const &p0 = position(c[0]), &p1 = position(c[1]), &p2 = position(c[2]);
+            double e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            double e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            double n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+            double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+            if (length <= 0.0)
+                return false;
+            plane = {n[0] / length, n[1] / length, n[2] / length, 0.0};
+            plane[3] = -(plane[0] * p0[0] + plane[1] * p0[1] + plane[2] * p0[2]);
+            return true;
+        }
+
+        void addBorderQuadrics(std::unordered_map<uint64_t, int> const &edgeUses) {
+            for (uint32_t t = 0; t < _triangles.size(); t++) {
+                if (_deadTriangles[t])
+                    continue;
+                auto c = corners(t);
+                std::array<double, 4> face;
+                if (!trianglePlane(c, face))
+                    continue;
+                for (size_t k = 0; k < 3; k++) {
+                    uint32_t a = c[k], b = c[(k + 1) % 3];
+                    if (edgeUses.at(edgeKey(a, b)) != 1)
+                        continue;
+                    auto const &pa = position(a), &pb = position(b);
+                    double e[3] = {pb[0] - pa[0], pb[1] - pa[1], pb[2] - pa[2]};
+                    double n[3] = {e[1] * face[2] - e[2] * face[1], e[2] * face[0] - e[0] * face[2], e[0] * face[1] - e[1] * face[0]};
+                    double length = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+                    if (length <= 0.0)
+                        continue;
+                    n[0] /= length; n[1] /= length; n[2] /= length;
+                    Quadric q = Quadric::plane(n[0], n[1], n[2], -(n[0] * pa[0] + n[1] * pa[1] + n[2] * pa[2]), BORDER_WEIGHT);
+                    _quadrics[a].add(q);
+                    _quadrics[b].add(q);
+                }
+            }
+        }
+
+        /* Queue the collapse of v onto each neighbour and of each neighbour onto v */
+        void pushCollapses(uint32_t v) {
+            for (auto t : _adjacency[v]) {
+                if (_deadTriangles[t])
+                    continue;
+                for (auto n : corners(t)) {
+                    if (n == v)
+                        continue;
+                    Quadric q = _quadrics[v];
+                    q.add(_quadrics[n]);
+                    _heap.push({q.evaluate(position(n)), v, n, _stamps[v], _stamps[n]});
+                    _heap.push({q.evaluate(position(v)), n, v, _stamps[n], _stamps[v]});
+                }
+            }
+        }
+
+        /* Moving `from` onto `to` must not turn any remaining triangle around */
+        bool flips(uint32_t from, uint32_t to) {
+            auto const &target = position(to);
+            for (auto t : _adjacency[from]) {
+                if (_deadTriangles[t])
+                    continue;
+                auto c = corners(t);
+                if (c[0] == to || c[1] == to || c[2] == to)
+                    continue;
+
+                std::array<std::array<float, 4>, 3> before, after;
+                for (size_t k = 0; k < 3; k++) {
+                    before[k] = position(c[k]);
+                    after[k] = c[k] == from ? target : before[k];
+                }
+                auto normal = [](std::array<std::array<float, 4>, 3> const &p) {
+                    float e1[3] = {p[1][0] - p[0][0], p[1][1] - p[0][1], p[1][2] - p[0][2]};
+                    float e2[3] = {p[2][0] - p[0][0], p[2][1] - p[0][1], p[2][2] - p[0][2]};
+                    return std::array<float, 3>{e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+                };
+                auto n0 = normal(before), n1 = normal(after);
+                if (n0[0] * n1[0] + n0[1] * n1[1] + n0[2] * n1[2] <= 0.0f)
+                    return true;
+            }
+            return false;
+        }
+
+        std::vector<GLuint> run(size_t targetTriangles, float &error) {
+            double maxCost = 0.0;
+
+            while (_aliveTriangles > targetTriangles && !_heap.empty()) {
+                Collapse collapse = _heap.top();
+                _heap.pop();
+                uint32_t from = collapse.from, to = collapse.to;
+                if (_collapsedTo[from] != from || _collapsedTo[to] != to
+                    || collapse.fromStamp != _stamps[from] || collapse.toStamp != _stamps[to])
+                    continue;
+                if (flips(from, to))
+                    continue;
+
+                _collapsedTo[from] = to;
+                for (auto t : _adjacency[from]) {
+                    if (_deadTriangles[t])
+                        continue;
+                    auto c = corners(t);
+                    if (c[0] == c[1] || c[1] == c[2] || c[0] == c[2]) {
+                        _deadTriangles[t] = true;
+                        _aliveTriangles--;
+                    } else {
+                        _adjacency[to].push_back(t);
+                    }
+                }
+                _adjacency[from].clear();
+                _quadrics[to].add(_quadrics[from]);
+                _stamps[to]++;
+                maxCost = std::max(maxCost, collapse.cost);
+                pushCollapses(to);
+            }
+
+            error = static_cast<float>(std::sqrt(maxCost));
+
+            /* Corners whose position survived keep their own vertex (and attributes) */
+            std::vector<GLuint> result;
+            result.reserve(_aliveTriangles * 3);
+            for (uint32_t t = 0; t < _triangles.size(); t++) {
+                if (_deadTriangles[t])
+                    continue;
+                for (auto v : _triangles[t]) {
+                    uint32_t current = find(_canonical[v]);
+                    result.push_back(current == _canonical[v] ? _globals[v] : _globals[current]);
+                }
+            }
+            return result;
+        }
+};
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <atomic>
+#include <array>
+#include <cstddef>
+
+/* Bounded lock-free queue for exactly one producer thread and one consumer thread.
+ * Each index is only written by its own side; the acquire/release pairs publish the slot contents. */
+template <typename T, size_t Capacity>
+class SpscQueue {
+    static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    public:
+        /* Returns false, dropping the value, when the queue is full */
+        bool push(T const &value) {
+            size_t tail = _tail.load(std::memory_order_relaxed);
+            if (tail - _head.load(std::memory_order_acquire) == Capacity)
+                return false;
+            _slots[tail & (Capacity - 1)] = value;
+            _tail.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool pop(T &value) {
+            size_t head = _head.load(std::memory_order_relaxed);
+            if (head == _tail.load(std::memory_order_acquire))
+                return false;
+            value = _slots[head & (Capacity - 1)];
+            _head.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool empty() const { return _head.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire); }
+
+    private:
+        std::array<T, Capacity> _slots;
+        /* On separate cache lines so the two threads do not invalidate each other's index */
+        alignas(64) std::atomic<size_t> _head{0};
+        alignas(64) std::atomic<size_t> _tail{0};
+};
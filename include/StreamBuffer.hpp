@@ -0,0 +1,113 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>
+
+/* Ring of regions in a single GL buffer used to stream per-frame data.
+ * When ARB_buffer_storage is available the buffer is persistently mapped and each region
+ * is guarded by a fence, so the CPU only waits if it laps the GPU. Otherwise writes go
+ * to a staging copy uploaded with glBufferSubData. A region holds a whole frame: several
+ * begin() / end() pairs are packed one after the other until fence() closes it. */
+class StreamBuffer {
+    public:
+        StreamBuffer(GLenum target, size_t regionSize, size_t regionCount = 3)
+            : _target(target), _regionSize(align(regionSize)), _regionCount(regionCount), _fences(regionCount, nullptr) {
+            _persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+
+            glGenBuffers(1, &_id);
+            glBindBuffer(_target, _id);
+            if (_persistent) {
+                GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+                glBufferStorage(_target, _regionSize * _regionCount, nullptr, flags);
+                _mapped = static_cast<unsigned char *>(glMapBufferRange(_target, 0, _regionSize * _regionCount, flags));
+                if (!_mapped) {
+                    std::cerr << "Failed to map stream buffer persistently" << std::endl;
+                    throw std::runtime_error("Failed to map stream buffer");
+                }
+            } else {
+                glBufferData(_target, _regionSize * _regionCount, nullptr, GL_STREAM_DRAW);
+                _staging.resize(_regionSize);
+            }
+            glBindBuffer(_target, 0);
+        }
+
+        ~StreamBuffer() {
+            for (auto fence : _fences)
+                if (fence)
+                    glDeleteSync(fence);
+            if (_persistent) {
+                glBindBuffer(_target, _id);
+                glUnmapBuffer(_target);
+                glBindBuffer(_target, 0);
+            }
+            glDeleteBuffers(1, &_id);
+        }
+
+        /* Pointer to the free part of the current region, getAvailable() bytes long, blocking until the
+         * GPU is done reading the region on its first write */
+        void *begin() {
+            if (!_persistent)
+                return _staging.data();
+
+            GLsync &fence = _fences[_region];
+            if (fence && _used == 0) {
+                while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, WAIT_TIMEOUT) == GL_TIMEOUT_EXPIRED)
+                    _stalls++;
+                glDeleteSync(fence);
+                fence = nullptr;
+            }
+            return _mapped + _region * _regionSize + _used;
+        }
+
+        /* Publish the first `size` bytes written since begin(), returns their offset in the buffer in bytes */
+        size_t end(size_t size) {
+            if (size > getAvailable()) {
+                std::cerr << "Stream buffer region overflow: " << size << " bytes, " << getAvailable() << " available" << std::endl;
+                throw std::runtime_error("Stream buffer region overflow");
+            }
+            size_t offset = _region * _regionSize + _used;
+            if (!_persistent && size) {
+                glBindBuffer(_target, _id);
+                glBufferSubData(_target, offset, size, _staging.data());
+                glBindBuffer(_target, 0);
+            }
+            _used = std::min(_regionSize, _used + align(size));
+            return offset;
+        }
+
+        /* Call once the draws reading the current region are submitted */
+        void fence() {
+            if (_persistent)
+                _fences[_region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            _region = (_region + 1) % _regionCount;
+            _used = 0;
+        }
+
+        GLuint getId() const { return _id; }
+        size_t getRegionSize() const { return _regionSize; }
+        size_t getAvailable() const { return _regionSize - _used; }
+        bool isPersistent() const { return _persistent; }
+        size_t getStalls() const { return _stalls; }
+
+    private:
+        static constexpr GLuint64 WAIT_TIMEOUT = 1000000000; // 1s
+        static constexpr size_t ALIGNMENT = 256; // Satisfies uniform and texture buffer offset alignment
+
+        GLenum _target;
+        GLuint _id = 0;
+        size_t _regionSize, _regionCount;
+        size_t _region = 0;
+        size_t _used = 0; // Bytes of the current region already written this frame
+        size_t _stalls = 0;
+        bool _persistent = false;
+        unsigned char *_mapped = nullptr;
+        std::vector<unsigned char> _staging;
+        std::vector<GLsync> _fences;
+
+        StreamBuffer(StreamBuffer const &src) = delete;
+
+        static size_t align(size_t size) { return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT; }
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <vector>
+#include <array>
+#include <cmath>
+#include <algorithm>
+
+#include "MeshVertex.hpp"
+#include "Parallel.hpp"
+
+/* Per-vertex tangent frames for normal mapping, following the MikkTSpace conventions:
+ * face tangents from the texture coordinate derivatives, accumulated with corner angle weights,
+ * orthogonalized against the vertex normal, and the bitangent sign stored in w so the shader
+ * rebuilds it as sign * cross(normal, tangent). Vertices are already split on uv and normal
+ * seams by Mesh, so mirrored islands never share a frame.
+ * Work is split between threads like NormalGenerator, one accumulation buffer per worker. */
+class TangentGenerator {
+    public:
+        /* Below this many triangles, threads cost more than they save */
+        static constexpr size_t PARALLEL_THRESHOLD = 16384;
+
+        /* One xyzw tangent per vertex, normals must already be filled */
+        static std::vector<std::array<float, 4>> generate(std::vector<MeshVertex> const &vertices, std::vector<GLuint> const &indices) {
+            size_t triangleCount = indices.size() / 3;
+            size_t workers = Parallel::workerCount(triangleCount, PARALLEL_THRESHOLD);
+            std::vector<std::vector<Frame>> sums(workers, std::vector<Frame>(vertices.size(), Frame{}));
+
+            Parallel::forRanges(workers, triangleCount, [&](size_t worker, size_t first, size_t last) {
+                for (size_t t = first; t < last; t++)
+                    accumulate(vertices, &indices[t * 3], sums[worker]);
+            });
+
+            std::vector<std::array<float, 4>> tangents(vertices.size());
+            Parallel::forRanges(workers, vertices.size(), [&](size_t, size_t first, size_t last) {
+                for (size_t v = first; v < last; v++) {
+                    Frame frame{};
+                    for (auto const &sum : sums)
+                        for (int k = 0; k < 3; k++) {
+                            frame.tangent[k] += sum[v].tangent[k];
+                            frame.bitangent[k] += sum[v].bitangent[k];
+                        }
+                    tangents[v] = orthogonalize(vertices[v].normal, frame);
+                }
+            });
+            return tangents;
+        }
+
+    private:
+        struct Frame {
+            std::array<float, 3> tangent;
+            std::array<float, 3> bitangent;
+        };
+
+        /* Add the unit face tangent and bitangent weighted by the corner angle to each corner */
+        static void accumulate(std::vector<MeshVertex> const &vertices, GLuint const *triangle, std::vector<Frame> &sums) {
+            auto const &p0 = vertices[triangle[0]].position, &p1 = vertices[triangle[1]].position, &p2 = vertices[triangle[2]].position;
+            auto const &t0 = vertices[triangle[0]].texCoord, &t1 = vertices[triangle[1]].texCoord, &t2 = vertices[triangle[2]].texCoord;
+
+            float e1[3] = {p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2]};
+            float e2[3] = {p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2]};
+            float du1 = t1[0] - t0[0], dv1 = t1[1] - t0[1];
+            float du2 = t2[0] - t0[0], dv2 = t2[1] - t0[1];
+            float det = du1 * dv2 - du2 * dv1;
+            if (det == 0.0f)
+                return;
+
+            /* Only the directions matter, the sign of the determinant carries the handedness */
+            float sign = det > 0.0f ? 1.0f : -1.0f;
+            float tangent[3], bitangent[3];
+            for (int k = 0; k < 3; k++) {
+                tangent[k] = (e1[k] * dv2 - e2[k] * dv1) * sign;
+                bitangent[k] = (e2[k] * du1 - e1[k] * du2) * sign;
+            }
+            if (!normalize(tangent) || !normalize(bitangent))
+                return;
+
+            for (int k = 0; k < 3; k++) {
+                auto const &a = vertices[triangle[k]].position;
+                auto const &b = vertices[triangle[(k + 1) % 3]].position;
+                auto const &c = vertices[triangle[(k + 2) % 3]].position;
+                float u[3] = {b[0] - a[0], b[1] - a[1], b[2] - a[2]};
+                float v[3] = {c[0] - a[0], c[1] - a[1], c[2] - a[2]};
+                float lengths = std::sqrt((u[0] * u[0] + u[1] * u[1] + u[2] * u[2]) * (v[0] * v[0] + v[1] * v[1] + v[2] * v[2]));
+                if (lengths <= 0.0f)
+                    continue;
+                float weight = std::acos(std::clamp((u[0] * v[0] + u[1] * v[1] + u[2] * v[2]) / lengths, -1.0f, 1.0f));
+                auto &sum = sums[triangle[k]];
+                for (int axis = 0; axis < 3; axis++) {
+                    sum.tangent[axis] += tangent[axis] * weight;
+                    sum.bitangent[axis] += bitangent[axis] * weight;
+                }
+            }
+        }
+
+        /* Gram-Schmidt against the normal, falling back to any perpendicular axis for degenerate uvs */
+        static std::array<float, 4> orthogonalize(std::array<float, 3> const &n, Frame const &frame) {
+            float t[3] = {frame.tangent[0], frame.tangent[1], frame.tangent[2]};
+            float d = normalize(t) ? n[0] * t[0] + n[1] * t[1] + n[2] * t[2] : 0.0f;
+            for (int k = 0; k < 3; k++)
+                t[k] -= n[k] * d;
+            /* A tangent (nearly) along the normal leaves only rounding noise after the projection */
+            if (t[0] * t[0] + t[1] * t[1] + t[2] * t[2] < 1e-6f || !normalize(t)) {
+                float axis[3] = {std::fabs(n[0]) < 0.9f ? 1.0f : 0.0f, std::fabs(n[0]) < 0.9f ? 0.0f : 1.0f, 0.0f};
+                d = n[0] * axis[0] + n[1] * axis[1];
+                t[0] = axis[0] - n[0] * d;
+                t[1] = axis[1] - n[1] * d;
+                t[2] = -n[2] * d;
+                normalize(t);
+            }
+            float c[3] = {n[1] * t[2] - n[2] * t[1], n[2] * t[0] - n[0] * t[2], n[0] * t[1] - n[1] * t[0]};
+            float handedness = c[0] * frame.bitangent[0] + c[1] * frame.bitangent[1] + c[2] * frame.bitangent[2];
+            return {t[0], t[1], t[2], handedness < 0.0f ? -1.0f : 1.0f};
+        }
+
+        static bool normalize(float v[3]) {
+            float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+            if (length <= 0.0f)
+                return false;
+            for (int k = 0; k < 3; k++)
+                v[k] /= length;
+            return true;
+        }
+};
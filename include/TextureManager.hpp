@@ -0,0 +1,425 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include <tuple>
+#include <chrono>
+#include <optional>
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <utility>
+#include <iostream>
+
+#include "BMP.hpp"
+#include "Parser.hpp"
+#include "JobSystem.hpp"
+
+/* Part of the texture array holding one image: offset and scale in layer uv space.
+ * layer is -1 for images that are not resident. */
+struct TextureRect {
+    float layer = -1.0f;
+    float offset[2] = {0.0f, 0.0f};
+    float scale[2] = {1.0f, 1.0f};
+};
+
+/* Streams the textures of the scene into a single GL_TEXTURE_2D_ARRAY bound once per frame, within a
+ * memory budget. Layers are split as quadtrees into pages, each resident texture holding the page
+ * matching the size of its resident mip level. Textures used by a frame are decoded into a mip chain
+ * by the job system, then uploaded from a coarse level up to full detail, one level per frame and
+ * at most UPLOAD_BUDGET bytes per frame; when pages run out the least recently used textures are evicted.
+ * Shaders repeat their uvs inside the rect of the image (see sampleRect in the fragment shader). */
+class TextureManager {
+    public:
+        static constexpr size_t UPLOAD_BUDGET = 8u << 20; // Bytes uploaded per frame at most
+        static constexpr unsigned MAX_DEPTH = 8;          // Smallest pages are 1/256th of a layer side
+        static constexpr unsigned FIRST_LEVEL_SIZE = 64;  // Streaming starts at the first level this small
+
+        struct Stats {
+            size_t residentBytes = 0;
+            size_t capacityBytes = 0;
+            size_t evictions = 0;
+            size_t uploadedBytes = 0;
+        };
+
+        /* `budget` bounds the size of the array in bytes, 0 sizes it for every texture at full detail */
+        explicit TextureManager(size_t budget = 0) : _budget(budget), _start(std::chrono::steady_clock::now()) {}
+        ~TextureManager() {
+            if (_texture)
+                glDeleteTextures(1, &_texture);
+        }
+        TextureManager(TextureManager const &) = delete;
+        TextureManager &operator=(TextureManager const &) = delete;
+
+        /* Add or replace an image decoded elsewhere, it is never evicted */
+        void set(std::string const &path, BMP image) {
+            Entry &entry = _entries[path];
+            release(entry);
+            entry = Entry();
+            entry.width = image.width;
+            entry.height = image.height;
+            entry.pinned = true;
+            entry.mips = buildMips(std::move(image));
+            _layoutDirty = true;
+        }
+
+        /* Track exactly these textures; they are only decoded once a frame uses them */
+        void load(std::vector<std::string> const &paths) {
+            for (auto it = _entries.begin(); it != _entries.end();) {
+                if (std::find(paths.begin(), paths.end(), it->first) != paths.end()) {
+                    ++it;
+                    continue;
+                }
+                release(it->second);
+                it = _entries.erase(it);
+                _layoutDirty = true;
+            }
+
+            for (auto const &path : paths) {
+                auto inserted = _entries.try_emplace(path);
+                if (!inserted.second)
+                    continue;
+                Entry &entry = inserted.first->second;
+                if (!Parser::readTextureSize(path, entry.width, entry.height)) {
+                    std::cerr << "Failed to load texture " << path << std::endl;
+                    entry.failed = true;
+                }
+                _layoutDirty = true;
+            }
+        }
+
+        /* Called once per frame, before drawing, with the textures the frame samples.
+         * Returns true when the rect of a texture changed. */
+        bool update(std::vector<std::string> const &used) {
+            _frame++;
+            if (_layoutDirty)
+                createArray();
+
+            _streaming = false;
+            size_t uploaded = 0;
+            for (auto const &path : used) {
+                auto it = _entries.find(path);
+                if (it == _entries.end() || it->second.lastUsed == _frame)
+                    continue;
+                Entry &entry = it->second;
+                entry.lastUsed = _frame;
+                if (entry.failed)
+                    continue;
+
+                if (entry.mips.empty()) {
+                    if (!entry.loading) {
+                        auto mips = entry.loaded = std::make_shared<std::vector<BMP>>();
+                        entry.loading = JobSystem::instance().submitBackground([mips, path]() { *mips = buildMips(Parser::readTexture(path)); });
+                    }
+                    if (!JobSystem::isDone(entry.loading)) {
+                        _streaming = true;
+                        continue;
+                    }
+                    try {
+                        /* Returns at once, rethrowing the exception of a failed decode */
+                        JobSystem::instance().wait(std::exchange(entry.loading, nullptr));
+                        entry.mips = std::move(*std::exchange(entry.loaded, nullptr));
+                    } catch (std::exception const &e) {
+                        std::cerr << "Failed to load texture " << path << ": " << e.what() << std::endl;
+                        entry.failed = true;
+                        continue;
+                    }
+                }
+
+                /* Coarse level first, then one level finer per frame down to the largest fitting a layer */
+                size_t finest = finestLevel(entry);
+                if (entry.level != NOT_RESIDENT && entry.level <= finest)
+                    continue;
+                size_t level = entry.level == NOT_RESIDENT ? firstLevel(entry, finest) : entry.level - 1;
+                BMP const &image = entry.mips[level];
+                if (uploaded && uploaded + image.data.size() > UPLOAD_BUDGET) {
+                    _streaming = true;
+                    continue;
+                }
+                auto page = allocateEvicting(depthFor(image));
+                if (!page)
+                    continue;
+
+                upload(image, *page);
+                release(entry);
+                entry.page = *page;
+                entry.level = level;
+                entry.residentBytes = image.data.size();
+                _stats.residentBytes += entry.residentBytes;
+                uploaded += image.data.size();
+                _changed = true;
+                _streaming |= level > finest;
+            }
+            _stats.uploadedBytes += uploaded;
+
+            bool changed = _changed;
+            _changed = false;
+            return changed;
+        }
+
+        /* True while textures used by the last frame are still loading or being refined */
+        bool isStreaming() const { return _streaming; }
+
+        TextureRect getRect(std::string const &path) const {
+            auto it = _entries.find(path);
+            if (it == _entries.end() || it->second.level == NOT_RESIDENT)
+                return TextureRect();
+            Entry const &entry = it->second;
+            BMP const &image = entry.mips[entry.level];
+            unsigned pageWidth = _width >> entry.page.depth, pageHeight = _height >> entry.page.depth;
+            TextureRect rect;
+            rect.layer = static_cast<float>(entry.page.layer);
+            rect.offset[0] = static_cast<float>(entry.page.x * pageWidth) / _width;
+            rect.offset[1] = static_cast<float>(entry.page.y * pageHeight) / _height;
+            rect.scale[0] = static_cast<float>(image.width) / _width;
+            rect.scale[1] = static_cast<float>(image.height) / _height;
+            return rect;
+        }
+
+        /* Bind the array for programs sampling it as `textures` */
+        void bind(GLuint programId, GLuint unit) const {
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, _texture);
+            glUniform1i(glGetUniformLocation(programId, "textures"), unit);
+        }
+
+        Stats const &getStats() const { return _stats; }
+
+        void report() const {
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - _start).count();
+            double mib = 1.0 / (1 << 20);
+            std::cout << "Textures: " << _stats.residentBytes * mib << " MiB resident of " << _stats.capacityBytes * mib << " MiB, "
+                << _stats.evictions << " evictions, " << _stats.uploadedBytes * mib << " MiB uploaded ("
+                << (seconds > 0.0 ? _stats.uploadedBytes * mib / seconds : 0.0) << " MiB/s)" << std::endl;
+        }
+
+    private:
+        static constexpr size_t NOT_RESIDENT = static_cast<size_t>(-1);
+
+        /* Node of a layer quadtree: (x, y) in units of the page size at this depth */
+        struct Page {
+            unsigned layer = 0, depth = 0, x = 0, y = 0;
+        };
+
+        struct Entry {
+            unsigned width = 0, height = 0; // Of the full detail image
+            bool pinned = false;
+            bool failed = false;
+            std::vector<BMP> mips;          // Empty until loaded and after eviction
+            JobSystem::Handle loading;      // Decode in flight, dropping it does not wait for it
+            std::shared_ptr<std::vector<BMP>> loaded; // Written by the decode job
+            size_t level = NOT_RESIDENT;    // Resident mip level
+            Page page;
+            size_t residentBytes = 0;
+            size_t lastUsed = 0;            // Frame
+        };
+
+        size_t _budget;
+        std::map<std::string, Entry> _entries; // Ordered, so the layout does not depend on hashing
+        std::vector<std::set<std::tuple<unsigned, unsigned, unsigned>>> _free; // Free pages per depth: (layer, x, y)
+        GLuint _texture = 0;
+        unsigned _width = 0, _height = 0;
+        size_t _layerCount = 0;
+        size_t _frame = 0;
+        bool _layoutDirty = true;
+        bool _changed = false;
+        bool _streaming = false;
+        Stats _stats;
+        std::chrono::steady_clock::time_point _start;
+
+        /* Box filtered chain down to 1x1, level 0 being the image itself */
+        static std::vector<BMP> buildMips(BMP image) {
+            std::vector<BMP> mips;
+            mips.push_back(std::move(image));
+            while (mips.back().width > 1 || mips.back().height > 1) {
+                BMP const &source = mips.back();
+                BMP level;
+                level.width = std::max(source.width / 2, 1u);
+                level.height = std::max(source.height / 2, 1u);
+                level.data.resize(static_cast<size_t>(level.width) * level.height * 3);
+                for (unsigned y = 0; y < level.height; y++) {
+                    for (unsigned x = 0; x < level.width; x++) {
+                        unsigned x0 = std::min(x * 2, source.width - 1), x1 = std::min(x * 2 + 1, source.width - 1);
+                        unsigned y0 = std::min(y * 2, source.height - 1), y1 = std::min(y * 2 + 1, source.height - 1);
+                        for (unsigned c = 0; c < 3; c++) {
+                            unsigned sum = source.data[(y0 * source.width + x0) * 3 + c] + source.data[(y0 * source.width + x1) * 3 + c]
+                                + source.data[(y1 * source.width + x0) * 3 + c] + source.data[(y1 * source.width + x1) * 3 + c];
+                            level.data[(static_cast<size_t>(y) * level.width + x) * 3 + c] = static_cast<unsigned char>((sum + 2) / 4);
+                        }
+                    }
+                }
+                mips.push_back(std::move(level));
+            }
+            return mips;
+        }
+
+        size_t finestLevel(Entry const &entry) const {
+            size_t level = 0;
+            while (level + 1 < entry.mips.size() && (entry.mips[level].width > _width || entry.mips[level].height > _height))
+                level++;
+            return level;
+        }
+
+        size_t firstLevel(Entry const &entry, size_t finest) const {
+            size_t level = finest;
+            while (level + 1 < entry.mips.size() && std::max(entry.mips[level].width, entry.mips[level].height) > FIRST_LEVEL_SIZE)
+                level++;
+            return level;
+        }
+
+        /* Smallest page holding the image */
+        unsigned depthFor(BMP const &image) const {
+            unsigned depth = 0;
+            while (depth < MAX_DEPTH && (_width >> (depth + 1)) >= image.width && (_height >> (depth + 1)) >= image.height)
+                depth++;
+            return depth;
+        }
+
+        /* Smallest power of two at least `value`, stopping at the largest representable one */
+        static unsigned powerOfTwo(unsigned value) {
+            unsigned result = 1;
+            while (result < value && result <= std::numeric_limits<unsigned>::max() / 2)
+                result <<= 1;
+            return result;
+        }
+
+        /* Size the array for the tracked textures and the budget. Layers are square powers of two so
+         * every page of the quadtree has an exact position; when the size changes every texture becomes
+         * non-resident and streams in again from the mip chains kept in memory. */
+        void createArray() {
+            _layoutDirty = false;
+            GLint maxSize = 0, maxLayers = 0;
+            glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+            glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+            unsigned size = 1;
+            size_t textures = 0;
+            for (auto const &entry : _entries) {
+                if (entry.second.failed)
+                    continue;
+                size = std::max({size, powerOfTwo(entry.second.width), powerOfTwo(entry.second.height)});
+                textures++;
+            }
+            size = std::min(size, static_cast<unsigned>(std::max(maxSize, 1)));
+            /* A budget below one layer gets smaller layers, the textures then stay at coarser levels */
+            unsigned fitting = size;
+            while (_budget && fitting > 1 && static_cast<size_t>(fitting) * fitting * 3 > _budget)
+                fitting /= 2;
+            if (fitting != size)
+                std::cerr << "Texture budget of " << _budget << " bytes is below one " << size << "x" << size
+                    << " layer, using " << fitting << "x" << fitting << " layers" << std::endl;
+            size = fitting;
+            size_t layerBytes = static_cast<size_t>(size) * size * 3;
+            /* A budget never buys more layers than every texture at full detail needs */
+            size_t layers = _budget ? std::min(_budget / layerBytes, textures) : textures;
+            layers = std::clamp<size_t>(layers, 1, static_cast<size_t>(std::max(maxLayers, 1)));
+            if (_texture && size == _width && size == _height && layers == _layerCount)
+                return;
+
+            for (auto &entry : _entries)
+                release(entry.second);
+            _width = _height = size;
+            _layerCount = layers;
+            _free.assign(MAX_DEPTH + 1, {});
+            for (unsigned layer = 0; layer < layers; layer++)
+                _free[0].insert({layer, 0u, 0u});
+            _stats.capacityBytes = layerBytes * layers;
+
+            if (!_texture)
+                glGenTextures(1, &_texture);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, _texture);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGB8, _width, _height, static_cast<GLsizei>(_layerCount), 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+            std::cout << "Texture array of " << _layerCount << " layers of " << _width << "x" << _height << std::endl;
+        }
+
+        void upload(BMP const &image, Page const &page) {
+            glBindTexture(GL_TEXTURE_2D_ARRAY, _texture);
+            /* Decoded rows are tightly packed RGB */
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, page.x * (_width >> page.depth), page.y * (_height >> page.depth), page.layer,
+                image.width, image.height, 1, GL_RGB, GL_UNSIGNED_BYTE, image.data.data());
+            glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+        }
+
+        /* Give the page of the entry back, keeping its decoded levels */
+        void release(Entry &entry) {
+            if (entry.level == NOT_RESIDENT)
+                return;
+            freePage(entry.page);
+            _stats.residentBytes -= entry.residentBytes;
+            entry.residentBytes = 0;
+            entry.level = NOT_RESIDENT;
+            _changed = true;
+        }
+
+        /* Evict the least recently used textures the current frame does not use until a page is free */
+        std::optional<Page> allocateEvicting(unsigned depth) {
+            while (true) {
+                if (auto page = allocatePage(depth))
+                    return page;
+                Entry *victim = nullptr;
+                for (auto &entry : _entries) {
+                    Entry &e = entry.second;
+                    if (e.pinned || e.level == NOT_RESIDENT || e.lastUsed == _frame)
+                        continue;
+                    if (!victim || e.lastUsed < victim->lastUsed)
+                        victim = &e;
+                }
+                if (!victim)
+                    return std::nullopt;
+                release(*victim);
+                victim->mips = {};
+                _stats.evictions++;
+            }
+        }
+
+        /* Buddy allocation: split the first free page of a lower depth when none is free at this one */
+        std::optional<Page> allocatePage(unsigned depth) {
+            auto &free = _free[depth];
+            if (!free.empty()) {
+                auto node = *free.begin();
+                free.erase(free.begin());
+                return Page{std::get<0>(node), depth, std::get<1>(node), std::get<2>(node)};
+            }
+            if (depth == 0)
+                return std::nullopt;
+            auto parent = allocatePage(depth - 1);
+            if (!parent)
+                return std::nullopt;
+            unsigned x = parent->x * 2, y = parent->y * 2;
+            free.insert({parent->layer, x + 1, y});
+            free.insert({parent->layer, x, y + 1});
+            free.insert({parent->layer, x + 1, y + 1});
+            return Page{parent->layer, depth, x, y};
+        }
+
+        /* Merge the page with its three siblings back into their parent when they are all free */
+        void freePage(Page const &page) {
+            auto &free = _free[page.depth];
+            if (page.depth > 0) {
+                unsigned x = page.x & ~1u, y = page.y & ~1u;
+                std::tuple<unsigned, unsigned, unsigned> siblings[3];
+                size_t count = 0;
+                for (unsigned dy = 0; dy < 2; dy++)
+                    for (unsigned dx = 0; dx < 2; dx++)
+                        if (x + dx != page.x || y + dy != page.y)
+                            siblings[count++] = {page.layer, x + dx, y + dy};
+                if (free.count(siblings[0]) && free.count(siblings[1]) && free.count(siblings[2])) {
+                    for (auto const &sibling : siblings)
+                        free.erase(sibling);
+                    freePage({page.layer, page.depth - 1, x / 2, y / 2});
+                    return;
+                }
+            }
+            free.insert({page.layer, page.x, page.y});
+        }
+};
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <iostream>
+
+#include "Shader.hpp"
+
+/* Weighted blended order independent transparency (McGuire and Bavoil, 2013).
+ * On frames with transparent draws the opaque ones are rendered into an offscreen target. The
+ * transparent ones then accumulate their premultiplied color, weighted by depth, into an RGBA16F
+ * target and the product of their transmittance into an R8 target, tested against the opaque depth
+ * without writing it. A fullscreen pass resolves the average color over the opaque image, which is
+ * blitted to the framebuffer that was bound, the window or an offscreen target. Nothing is sorted;
+ * overlapping surfaces of very different colors blend approximately. */
+class TransparencyPass {
+    public:
+        static constexpr GLuint ACCUM_UNIT = 0;
+        static constexpr GLuint REVEALAGE_UNIT = 1;
+
+        TransparencyPass() : _composite("shaders/composite_vertex.glsl", "shaders/composite_fragment.glsl", 0) {
+            glGenVertexArrays(1, &_emptyVao);
+        }
+        ~TransparencyPass() {
+            release();
+            glDeleteVertexArrays(1, &_emptyVao);
+        }
+        TransparencyPass(TransparencyPass const &) = delete;
+        TransparencyPass &operator=(TransparencyPass const &) = delete;
+
+        /* Redirect the opaque draws to the offscreen target, cleared like the window */
+        void beginOpaque() {
+            /* Read before create(), which leaves the default framebuffer bound */
+            glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &_target);
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            if (viewport[2] != _width || viewport[3] != _height)
+                create(viewport[2], viewport[3]);
+            glBindFramebuffer(GL_FRAMEBUFFER, _sceneFbo);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            _accumulated = false;
+        }
+
+        /* Accumulation state for the transparent draws, drawn with the Shader::OIT variant */
+        void beginTransparent() {
+            static const GLfloat zero[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+            static const GLfloat one[4] = {1.0f, 1.0f, 1.0f, 1.0f};
+            glBindFramebuffer(GL_FRAMEBUFFER, _accumFbo);
+            glClearBufferfv(GL_COLOR, 0, zero);
+            glClearBufferfv(GL_COLOR, 1, one);
+            glDepthMask(GL_FALSE);
+            glEnable(GL_BLEND);
+            glBlendFunci(0, GL_ONE, GL_ONE);
+            glBlendFunci(1, GL_ZERO, GL_ONE_MINUS_SRC_COLOR);
+            _accumulated = true;
+        }
+
+        /* Resolve the transparent layers over the opaque image and copy it to the target */
+        void end() {
+            glDepthMask(GL_TRUE);
+            glBindFramebuffer(GL_FRAMEBUFFER, _sceneFbo);
+            if (_accumulated) {
+                glEnable(GL_BLEND);
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                glDisable(GL_DEPTH_TEST);
+                _composite.use();
+                glActiveTexture(GL_TEXTURE0 + ACCUM_UNIT);
+                glBindTexture(GL_TEXTURE_2D, _accumTexture);
+                _composite.setTexture("accumTexture", ACCUM_UNIT);
+                glActiveTexture(GL_TEXTURE0 + REVEALAGE_UNIT);
+                glBindTexture(GL_TEXTURE_2D, _revealageTexture);
+                _composite.setTexture("revealageTexture", REVEALAGE_UNIT);
+                glActiveTexture(GL_TEXTURE0);
+                glBindVertexArray(_emptyVao);
+                glDrawArrays(GL_TRIANGLES, 0, 3);
+                glBindVertexArray(0);
+                glEnable(GL_DEPTH_TEST);
+            }
+            glDisable(GL_BLEND);
+
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, _sceneFbo);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, _target);
+            glBlitFramebuffer(0, 0, _width, _height, 0, 0, _width, _height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, _target);
+        }
+
+    private:
+        Shader _composite;
+        GLuint _emptyVao = 0;
+        GLuint _sceneFbo = 0, _accumFbo = 0;
+        GLuint _colorTexture = 0, _depthTexture = 0, _accumTexture = 0, _revealageTexture = 0;
+        GLint _width = 0, _height = 0;
+        GLint _target = 0; // Framebuffer bound before the opaque pass
+        bool _accumulated = false;
+
+        static GLuint createTexture(GLint internalFormat, GLenum format, GLenum type, GLint width, GLint height) {
+            GLuint texture;
+            glGenTextures(1, &texture);
+            glBindTexture(GL_TEXTURE_2D, texture);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, nullptr);
+            return texture;
+        }
+
+        /* Both framebuffers share the depth texture, so transparent fragments are tested against the opaque depth */
+        void create(GLint width, GLint height) {
+            release();
+            _width = width;
+            _height = height;
+            _colorTexture = createTexture(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, width, height);
+            _depthTexture = createTexture(GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, width, height);
+            _accumTexture = createTexture(GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT, width, height);
+            _revealageTexture = createTexture(GL_R8, GL_RED, GL_UNSIGNED_BYTE, width, height);
+            glBindTexture(GL_TEXTURE_2D, 0);
+
+            glGenFramebuffers(1, &_sceneFbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, _sceneFbo);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _colorTexture, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _depthTexture, 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cerr << "Incomplete opaque framebuffer" << std::endl;
+
+            glGenFramebuffers(1, &_accumFbo);
+            glBindFramebuffer(GL_FRAMEBUFFER, _accumFbo);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _accumTexture, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, _revealageTexture, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, _depthTexture, 0);
+            static const GLenum drawBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+            glDrawBuffers(2, drawBuffers);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cerr << "Incomplete transparency framebuffer" << std::endl;
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+        void release() {
+            if (!_sceneFbo)
+                return;
+            glDeleteFramebuffers(1, &_sceneFbo);
+            glDeleteFramebuffers(1, &_accumFbo);
+            GLuint textures[4] = {_colorTexture, _depthTexture, _accumTexture, _revealageTexture};
+            glDeleteTextures(4, textures);
+            _sceneFbo = _accumFbo = 0;
+        }
+};
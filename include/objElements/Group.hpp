@@ -12,8 +12,8 @@ struct Group {
     Group() = default;
     Group(std::string const &name) : name(name) {}
 
-    void addFace(std::vector<std::string> const &tokens, size_t &lineNb, std::array<size_t, 3> &geometryElemCounts, Material *mat, int &smoothingGroup) {
-        faces.emplace_back(tokens, lineNb, geometryElemCounts, mat, smoothingGroup);
+    Face &addFace(std::vector<std::string> const &tokens, size_t &lineNb, std::array<size_t, 3> &geometryElemCounts, Material *mat, int &smoothingGroup) {
+        return faces.emplace_back(tokens, lineNb, geometryElemCounts, mat, smoothingGroup);
     }
 
     void addLine(std::vector<std::string> const &tokens, size_t &lineNb, size_t &vertexCount) {
@@ -27,8 +27,9 @@ struct Group {
         std::string currMatName = "";
         int currSmoothingGroup = -1;
         for (const auto& f : g.faces) {
-            if (f.material->_name != currMatName) {
-                currMatName = f.material->_name;
+            std::string matName = f.material ? f.material->_name : "";
+            if (matName != currMatName) {
+                currMatName = matName;
                 os << "usemtl " << currMatName << std::endl;
             }
             if (f.smoothingGroup != currSmoothingGroup) {
@@ -5,13 +5,17 @@
 #include "Material.hpp"
 
 struct MTL {
-    std::unordered_map<std::string, Material> _materials;
-    Material *_currentMaterial = nullptr;
+    /* In file order, a repeated newmtl edits the material of the first one */
+    std::vector<Material> _materials;
+    std::string _path;
 
     MTL() {}
     MTL(const std::string objPath, const std::string mtlPath) {
         size_t pos = objPath.find_last_of('/');
         std::string filePath = (pos != std::string::npos) ? objPath.substr(0, pos + 1) + mtlPath : mtlPath;
+        _path = filePath;
+        size_t directoryEnd = filePath.find_last_of('/');
+        std::string directory = directoryEnd != std::string::npos ? filePath.substr(0, directoryEnd + 1) : "";
 
 
         std::ifstream file(filePath);
@@ -22,6 +26,9 @@ struct MTL {
 
         std::string line;
         size_t lineNb = 1;
+        std::unordered_map<std::string, size_t> indices;
+        Material *currentMaterial = nullptr;
+        float values[3];
 
         while (std::getline(file, line)) {
             if (line.empty() || line[0] == '#') {
@@ -42,21 +49,22 @@ struct MTL {
                         std::cerr << "Invalid material name: " << lineNb << std::endl;
                         throw std::exception();
                     }
-                    _materials.emplace(tokens[1], tokens[1]);
-                    _currentMaterial = &_materials[tokens[1]];
+                    if (indices.emplace(tokens[1], _materials.size()).second)
+                        _materials.emplace_back(tokens[1]);
+                    currentMaterial = &_materials[indices.at(tokens[1])];
                     break;
 
                 case AMBIENT:
                 case DIFFUSE:
                 case SPECULAR:
                 case TRANSMISSION_FILTER:
-                    if (_currentMaterial == nullptr) {
+                    if (currentMaterial == nullptr) {
                         std::cerr << "No material defined on line " << lineNb << std::endl;
                         throw std::exception();
                     }
-                    if (!checkElemValid(eType, tokens, lineNb))
+                    if (!readMtlValues(eType, tokens, lineNb, values))
                         throw std::exception();
-                    _currentMaterial->addRGB(eType, tokens, lineNb);
+                    currentMaterial->addRGB(eType, values, lineNb);
                     break;
 
                 case SPECULAR_EXPONENT:
@@ -64,19 +72,31 @@ struct MTL {
                 case TRANSPARENT:
                 case OPTICAL_DENSITY:
                 case ILLUMINATION:
-                    if (_currentMaterial == nullptr) {
+                    if (currentMaterial == nullptr) {
                         std::cerr << "No material defined on line " << lineNb << std::endl;
                         throw std::exception();
                     }
-                    if (!checkElemValid(eType, tokens, lineNb))
+                    if (!readMtlValues(eType, tokens, lineNb, values))
                         throw std::exception();
-                    _currentMaterial->addValue(eType, tokens, lineNb);
+                    currentMaterial->addValue(eType, values[0], lineNb);
                     break;
 
 
+                case DIFFUSE_MAP:
+                case NORMAL_MAP:
+                    if (currentMaterial == nullptr) {
+                        std::cerr << "No material defined on line " << lineNb << std::endl;
+                        throw std::exception();
+                    }
+                    /* The file name comes last, after options such as -s, -o or -bm which are not supported */
+                    if (tokens.size() > 2)
+                        std::cerr << "Ignoring " << tokens[0] << " options on line " << lineNb << std::endl;
+                    (eType == DIFFUSE_MAP ? currentMaterial->_diffuseMap : currentMaterial->_normalMap) = directory + tokens.back();
+                    break;
+
                 case UNKNOWN_:
-                    std::cerr << "Unknown prefix: " << tokens[0] << " on line " << lineNb << std::endl;
-                    throw std::exception();
+                    /* Exporters emit many statements we do not render (map_*, Ke...), skip them */
+                    std::cerr << "Ignoring unsupported prefix: " << tokens[0] << " on line " << lineNb << std::endl;
                     break;
             }
             lineNb++;
@@ -87,7 +107,7 @@ struct MTL {
     ~MTL() {}
 
     friend std::ostream& operator<<(std::ostream& os, const MTL& mtl) {
-        for (auto& [name, mat] : mtl._materials)
+        for (auto& mat : mtl._materials)
             os << mat << std::endl;
         return os;
     }
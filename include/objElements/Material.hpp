@@ -18,28 +18,27 @@ struct Material {
     float _dissolve = 1.0f;
     float _opticalDensity = 1.0f;
     size_t _illumination = 0;
+    std::string _diffuseMap; // Path of the map_Kd image, resolved against the library directory
+    std::string _normalMap;  // Path of the tangent space normal map given by map_Bump, bump or norm
 
     Material() {}
     Material(const std::string &name) : _name(name) {}
 
-    void addRGB(MtlElemType elemType, std::vector<std::string> &tokens, size_t lineNb) {
-        if (tokens.size() != 4) {
-            std::cerr << "Invalid ambient color definition: " << lineNb << std::endl;
-            throw std::exception();
-        }
-
+    /* Values come from readMtlValues, already converted and checked */
+    void addRGB(MtlElemType elemType, float const *values, size_t lineNb) {
+        RGB color = {values[0], values[1], values[2]};
         switch (elemType) {
             case AMBIENT:
-                _ambient = {std::stof(tokens[1]), std::stof(tokens[2]), std::stof(tokens[3])};
+                _ambient = color;
                 break;
             case DIFFUSE:
-                _diffuse = {std::stof(tokens[1]), std::stof(tokens[2]), std::stof(tokens[3])};
+                _diffuse = color;
                 break;
             case SPECULAR:
-                _specular = {std::stof(tokens[1]), std::stof(tokens[2]), std::stof(tokens[3])};
+                _specular = color;
                 break;
             case TRANSMISSION_FILTER:
-                _transmissionFilter = {std::stof(tokens[1]), std::stof(tokens[2]), std::stof(tokens[3])};
+                _transmissionFilter = color;
                 break;
             default:
                 std::cerr << "Invalid RGB type: " << lineNb << std::endl;
@@ -47,27 +46,22 @@ struct Material {
         }
     }
 
-    void addValue(MtlElemType elemType, std::vector<std::string> &tokens, size_t lineNb) {
-        if (tokens.size() != 2) {
-            std::cerr << "Invalid specular exponent definition: " << lineNb << std::endl;
-            throw std::exception();
-        }
-
+    void addValue(MtlElemType elemType, float value, size_t lineNb) {
         switch (elemType) {
             case SPECULAR_EXPONENT:
-                _specularExponent = std::stof(tokens[1]);
+                _specularExponent = value;
                 break;
             case DISSOLVE:
-                _dissolve = std::stof(tokens[1]);
+                _dissolve = value;
                 break;
             case TRANSPARENT:
-                _dissolve = 1 - std::stof(tokens[1]);
+                _dissolve = 1 - value;
                 break;
             case OPTICAL_DENSITY:
-                _opticalDensity = std::stof(tokens[1]);
+                _opticalDensity = value;
                 break;
             case ILLUMINATION:
-                _illumination = std::stoi(tokens[1]);
+                _illumination = static_cast<size_t>(value);
                 break;
             default:
                 std::cerr << "Invalid value type: " << lineNb << std::endl;
@@ -8,6 +8,9 @@
 
 #include <unordered_map>
 #include <optional>
+#include <functional>
+#include <cstring>
+#include <cstdint>
 
 struct Object {
     std::string _name;
@@ -24,12 +27,12 @@ struct Object {
     void addVertex(std::vector<std::string> const &tokens, size_t &lineNb) { _vertices.emplace_back(tokens, lineNb); }
     void addTexCoord(std::vector<std::string> const &tokens, size_t &lineNb) { _texCoords.emplace_back(tokens, lineNb); }
     void addNormal(std::vector<std::string> const &tokens, size_t &lineNb) { _normals.emplace_back(tokens, lineNb); }
-    void addFace(std::vector<std::string> const &tokens, size_t &lineNb, std::array<size_t, 3> &geometryElemCounts, Material *mat, int &smoothingGroup) {
+    Face &addFace(std::vector<std::string> const &tokens, size_t &lineNb, std::array<size_t, 3> &geometryElemCounts, Material *mat, int &smoothingGroup) {
         if (currentGroup == nullptr) {
             _groups.emplace("default", Group(""));
             currentGroup = &_groups[""];
         }
-        currentGroup->addFace(tokens, lineNb, geometryElemCounts, mat, smoothingGroup);
+        return currentGroup->addFace(tokens, lineNb, geometryElemCounts, mat, smoothingGroup);
     }
     void addLine(std::vector<std::string> const &tokens, size_t &lineNb, size_t &vertexCount) {
         if (currentGroup == nullptr) {
@@ -62,11 +65,46 @@ struct Object {
         return os;
     }
 
+    /* Hash of the geometry and material assignment, independent of where the object sits in the file */
+    size_t fingerprint() const {
+        size_t h = std::hash<std::string>()(_name);
+        for (auto const &v : _vertices)
+            h = mix(mix(mix(mix(h, v.x), v.y), v.z), v.w);
+        for (auto const &t : _texCoords)
+            h = mix(mix(mix(h, t.u), t.v), t.w);
+        for (auto const &n : _normals)
+            h = mix(mix(mix(h, n.x), n.y), n.z);
+        /* Groups are unordered, so their hashes are summed */
+        size_t groups = 0;
+        for (auto const &g : _groups) {
+            size_t gh = std::hash<std::string>()(g.first);
+            for (auto const &face : g.second.faces) {
+                gh = mix(gh, std::hash<std::string>()(face.material ? face.material->_name : ""));
+                gh = mix(gh, std::hash<int>()(face.smoothingGroup));
+                for (auto const *indices : {&face.vertexIndices, &face.textureIndices, &face.normalIndices})
+                    for (int index : *indices)
+                        gh = mix(gh, std::hash<int>()(index));
+            }
+            for (auto const &line : g.second.lines)
+                for (size_t index : line.vertexIndices)
+                    gh = mix(gh, index);
+            groups += gh;
+        }
+        return mix(h, groups);
+    }
+
     Vertex getVertexByIndex(size_t index) const { return _vertices[index]; }
     TexCoord getTexCoordByIndex(size_t index) const { return _texCoords[index]; }
     Normal getNormalByIndex(size_t index) const { return _normals[index]; }
 
     private:
         Group *currentGroup = nullptr;
+
+        static size_t mix(size_t h, size_t value) { return h ^ (value + 0x9e3779b9 + (h << 6) + (h >> 2)); }
+        static size_t mix(size_t h, float value) {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            return mix(h, static_cast<size_t>(bits));
+        }
  
 };
\ No newline at end of file
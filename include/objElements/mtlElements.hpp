@@ -3,7 +3,6 @@
 #include <unordered_map>
 #include <string>
 #include <iostream>
-#include <functional>
 
 #include "parsingUtils.hpp"
 
@@ -18,6 +17,8 @@ enum MtlElemType {
     TRANSMISSION_FILTER,
     OPTICAL_DENSITY,
     ILLUMINATION,
+    DIFFUSE_MAP,
+    NORMAL_MAP,
     UNKNOWN_
 };
 
@@ -31,7 +32,11 @@ const std::unordered_map<std::string, MtlElemType> mtlElemMap = {
     {"Tr", TRANSPARENT},
     {"Tf", TRANSMISSION_FILTER},
     {"Ni", OPTICAL_DENSITY},
-    {"illum", ILLUMINATION}
+    {"illum", ILLUMINATION},
+    {"map_Kd", DIFFUSE_MAP},
+    {"map_Bump", NORMAL_MAP},
+    {"bump", NORMAL_MAP},
+    {"norm", NORMAL_MAP}
 };
 
 const std::unordered_map<MtlElemType, size_t> mtlElemSize = {
@@ -59,19 +64,6 @@ const std::unordered_map<MtlElemType, Bound> mtlElemBounds = {
     {ILLUMINATION, Bound(0, 10)}
 };
 
-const std::unordered_map<MtlElemType, std::function<std::pair<bool, IntOrFloat>(std::string)>> mtlElemCheckTypeFuncs = {
-    {NEW_MAT, nullptr},
-    {AMBIENT, isFloat},
-    {DIFFUSE, isFloat},
-    {SPECULAR, isFloat},
-    {SPECULAR_EXPONENT, isFloat},
-    {DISSOLVE, isFloat},
-    {TRANSPARENT, isFloat},
-    {TRANSMISSION_FILTER, isFloat},
-    {OPTICAL_DENSITY, isFloat},
-    {ILLUMINATION, isInteger}
-};
-
 MtlElemType getMtlElemType(const std::string& prefix) {
     auto it = mtlElemMap.find(prefix);
     if (it != mtlElemMap.end())
@@ -79,26 +71,34 @@ MtlElemType getMtlElemType(const std::string& prefix) {
     return UNKNOWN_;
 }
 
-bool checkElemValid(MtlElemType elemType, std::vector<std::string> &tokens, size_t lineNb) {
+/* Check the argument count, then convert and bound-check each value once.
+ * Illumination models are integers, stored in `values` like the other statements. */
+bool readMtlValues(MtlElemType elemType, std::vector<std::string> const &tokens, size_t lineNb, float *values) {
     if (tokens.size() - 1 != mtlElemSize.at(elemType)) {
         std::cerr << "Invalid number of arguments for " << elemType << ": " << lineNb << std::endl;
         return false;
     }
 
-    if (mtlElemCheckTypeFuncs.at(elemType) == nullptr)
-        return true;
-
+    Bound const &bound = mtlElemBounds.at(elemType);
     for (size_t i = 1; i < tokens.size(); i++) {
-        auto res = mtlElemCheckTypeFuncs.at(elemType)(tokens[i]);
-        if (!res.first) {
-            std::cerr << "Invalid value for " << elemType << ": " << lineNb << std::endl;
-            return false;
+        IntOrFloat value;
+        bool valid;
+        if (elemType == ILLUMINATION) {
+            int integer;
+            valid = parseNumber(tokens[i], integer);
+            value = integer;
+            values[i - 1] = static_cast<float>(integer);
+        } else {
+            float number;
+            valid = parseNumber(tokens[i], number);
+            value = number;
+            values[i - 1] = number;
         }
 
-        if (!mtlElemBounds.at(elemType).isInside(res.second)) {
+        if (!valid || !bound.isInside(value)) {
             std::cerr << "Invalid value for " << elemType << ": " << lineNb << std::endl;
             return false;
         }
     }
     return true;
-}
\ No newline at end of file
+}
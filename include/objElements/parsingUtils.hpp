@@ -5,6 +5,9 @@
 #include <sstream>
 #include <utility>
 #include <variant>
+#include <cstdlib>
+#include <cerrno>
+#include <climits>
 
 using IntOrFloat = std::variant<int, float>;
 
@@ -21,12 +24,14 @@ struct Bound {
 
 std::vector<std::string> split(const std::string &s, char delimiter) {
     std::vector<std::string> tokens;
-    std::string token;
-    std::istringstream tokenStream(s);
-    while (std::getline(tokenStream, token, delimiter)) {
-        if (!token.empty()) { // Optionally skip empty tokens
-            tokens.push_back(token);
-        }
+    size_t start = 0;
+    while (start < s.size()) {
+        size_t end = s.find(delimiter, start);
+        if (end == std::string::npos)
+            end = s.size();
+        if (end > start) // Optionally skip empty tokens
+            tokens.emplace_back(s, start, end - start);
+        start = end + 1;
     }
     return tokens;
 }
@@ -43,4 +48,20 @@ std::pair<bool, int> isInteger(const std::string& s) {
     int i;
     iss >> std::noskipws >> i;
     return std::make_pair(iss.eof() && !iss.fail(), i);
+}
+
+/* Single pass conversions: the whole token must be consumed and the value must be representable */
+bool parseNumber(const std::string &s, float &value) {
+    char *end = nullptr;
+    errno = 0;
+    value = std::strtof(s.c_str(), &end);
+    return end != s.c_str() && *end == '\0' && errno != ERANGE;
+}
+
+bool parseNumber(const std::string &s, int &value) {
+    char *end = nullptr;
+    errno = 0;
+    long parsed = std::strtol(s.c_str(), &end, 10);
+    value = static_cast<int>(parsed);
+    return end != s.c_str() && *end == '\0' && errno != ERANGE && parsed >= INT_MIN && parsed <= INT_MAX;
 }
\ No newline at end of file
@@ -0,0 +1,19 @@
+#version 330 core
+
+// Resolves the weighted blended transparency targets over the opaque image, see TransparencyPass
+
+uniform sampler2D accumTexture;
+uniform sampler2D revealageTexture;
+
+out vec4 FragColor;
+
+void main() {
+    ivec2 texel = ivec2(gl_FragCoord.xy);
+    float revealage = texelFetch(revealageTexture, texel, 0).r;
+    if (revealage >= 1.0)
+        discard;
+
+    vec4 accum = texelFetch(accumTexture, texel, 0);
+    vec3 average = accum.rgb / max(accum.a, 1e-5);
+    FragColor = vec4(average, 1.0 - revealage);
+}
@@ -0,0 +1,5 @@
+#version 330 core
+
+// Depth pre-pass, see DepthPrepass: only the depth written by the rasterizer is kept
+void main() {
+}
@@ -1,50 +1,104 @@
 #version 330 core
 
-out vec4 FragColor;
+// Compiled once per combination of HAS_NORMALS, TEXTURED, HAS_MATERIALS and OIT_PASS, see Shader
 
-struct Material {
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-    float shininess;
-};
+#ifdef OIT_PASS
+// Weighted blended transparency targets, see TransparencyPass
+layout (location = 0) out vec4 accum;
+layout (location = 1) out float revealage;
+#else
+out vec4 FragColor;
+#endif
 
 in vec3 fragPos;
 in vec3 normal;
+in vec4 tangent;
+in vec2 texCoord;
+flat in int materialIndex;
+
+// Material table, 7 texels per material: (ambient, dissolve), (diffuse, shininess),
+// (specular, optical density), (transmission filter, illumination), (diffuse map offset, scale),
+// (diffuse map layer or -1, normal map layer or -1, 0, 0) and (normal map offset, scale), see Mesh
+uniform samplerBuffer materialData;
+
+layout (std140) uniform FrameData {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+    float textureState;
+};
+// Every resident texture, see TextureManager; the command line texture is at textureRect (offset, scale) of textureLayer
+uniform sampler2DArray textures;
+uniform vec4 textureRect;
+uniform float textureLayer;
 
-// uniform Material material;
-uniform int hasNormals;
-uniform float textureState;
-uniform sampler2D textureSampler;
+// Repeat uv inside the rect of an image, staying half a texel inside it so filtering never reads its neighbours
+vec4 sampleRect(vec2 uv, vec4 rect, float layer) {
+    vec2 halfTexel = 0.5 / vec2(textureSize(textures, 0).xy);
+    vec2 local = clamp(fract(uv) * rect.zw, halfTexel, rect.zw - halfTexel);
+    return texture(textures, vec3(rect.xy + local, layer));
+}
 
 void main() {
     vec4 baseColor;
-    vec4 textureColor;
 
     // Base color when no texture or normals
-    if (hasNormals == 0) {
-        float greyScale = (1.0 + gl_PrimitiveID % 4) / 5.0;
-        baseColor = vec4(greyScale, greyScale, greyScale, 1.0);
-    } else {
-        // Default base color
-        baseColor = vec4(1.0, 1.0, 1.0, 1.0);
-    }
+#ifdef HAS_NORMALS
+    // Default base color
+    baseColor = vec4(1.0, 1.0, 1.0, 1.0);
+#else
+    float greyScale = (1.0 + gl_PrimitiveID % 4) / 5.0;
+    baseColor = vec4(greyScale, greyScale, greyScale, 1.0);
+#endif
 
+#ifdef HAS_MATERIALS
+    baseColor *= vec4(texelFetch(materialData, materialIndex * 7 + 1).rgb, 1.0);
+    vec2 mapLayers = texelFetch(materialData, materialIndex * 7 + 5).xy;
+    float mapLayer = mapLayers.x;
+    if (mapLayer >= 0.0)
+        baseColor *= sampleRect(texCoord, texelFetch(materialData, materialIndex * 7 + 4), mapLayer);
+#endif
+
+#ifdef TEXTURED
     // Calculate texture color
     float scaleFactor = 1.0;
-    vec2 texCoords = mod(fragPos.xy * scaleFactor, 1.0);
-    textureColor = texture(textureSampler, texCoords);
+    // Layer -1 until the texture is resident
+    vec4 textureColor = textureLayer >= 0.0 ? sampleRect(fragPos.xy * scaleFactor, textureRect, textureLayer) : baseColor;
 
     // Transition
     vec4 colorOutput = mix(baseColor, textureColor, textureState);
+#else
+    vec4 colorOutput = baseColor;
+#endif
 
     // Apply lighting if normals are present
-    if (hasNormals > 0) {
-        vec3 lightDirection = normalize(vec3(1.0, 1.0, 1.0));
-        float diff = max(dot(normal, lightDirection), 0.0);
-        vec3 diffuse = diff * vec3(1.0, 1.0, 1.0);
-        FragColor = vec4(diffuse, 1.0) * colorOutput;
-    } else {
-        FragColor = colorOutput;
+#ifdef HAS_NORMALS
+    vec3 shadingNormal = normal;
+#ifdef HAS_MATERIALS
+    // Tangent space normal map; the tangent is zero when the mesh has no texture coordinates
+    if (mapLayers.y >= 0.0 && dot(tangent.xyz, tangent.xyz) > 0.0) {
+        vec3 n = normalize(normal);
+        vec3 t = normalize(tangent.xyz - n * dot(n, tangent.xyz));
+        vec3 b = cross(n, t) * tangent.w;
+        vec3 mapped = sampleRect(texCoord, texelFetch(materialData, materialIndex * 7 + 6), mapLayers.y).xyz * 2.0 - 1.0;
+        shadingNormal = normalize(mat3(t, b, n) * mapped);
     }
+#endif
+    vec3 lightDirection = normalize(vec3(1.0, 1.0, 1.0));
+    float diff = max(dot(shadingNormal, lightDirection), 0.0);
+    vec3 diffuse = diff * vec3(1.0, 1.0, 1.0);
+    vec4 color = vec4(diffuse, 1.0) * colorOutput;
+#else
+    vec4 color = colorOutput;
+#endif
+
+#ifdef OIT_PASS
+    // Coverage from the material dissolve, weighted so nearer surfaces dominate the average
+    float alpha = texelFetch(materialData, materialIndex * 7).a;
+    float weight = clamp(alpha * max(1e-2, 3e3 * pow(1.0 - gl_FragCoord.z, 3.0)), 1e-2, 3e3);
+    accum = vec4(color.rgb * alpha, alpha) * weight;
+    revealage = alpha;
+#else
+    FragColor = color;
+#endif
 }
@@ -1,23 +1,62 @@
 #version 330 core
 layout (location = 0) in vec4 aPos;
 layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec3 aTexCoord;
+layout (location = 3) in uint aDrawId;
+// xyz tangent, w bitangent sign; only bound when the mesh has texture coordinates
+layout (location = 4) in vec4 aTangent;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+layout (std140) uniform FrameData {
+    mat4 model;
+    mat4 view;
+    mat4 projection;
+    float textureState;
+};
+
+// Per-draw data: object transform (4 texels) followed by the material index
+uniform samplerBuffer drawData;
+
+#ifdef INSTANCED
+// Per-instance transforms (4 texels each) starting at instanceOffset, see InstanceSet
+uniform samplerBuffer instanceData;
+uniform int instanceOffset;
+#endif
 
 out vec3 fragPos;
 out vec3 normal;
+out vec4 tangent;
+out vec2 texCoord;
+flat out int materialIndex;
 
-uniform int hasNormals;
+// Same depth in the depth pre-pass and the GL_EQUAL color pass, see DepthPrepass
+invariant gl_Position;
 
 void main() {
-    gl_Position = gl_Position = projection * view * model * aPos;
-    fragPos = vec3(model * aPos).xyz;
-;
-
-    if (hasNormals > 0)
-        normal = mat3(model) * aNormal;
-    else
-        normal = vec3(0.0, 0.0, 1.0);
-}
\ No newline at end of file
+    int base = int(aDrawId) * 5;
+    mat4 drawTransform = mat4(
+        texelFetch(drawData, base + 0),
+        texelFetch(drawData, base + 1),
+        texelFetch(drawData, base + 2),
+        texelFetch(drawData, base + 3));
+    materialIndex = int(texelFetch(drawData, base + 4).x);
+    mat4 world = model * drawTransform;
+#ifdef INSTANCED
+    int instanceBase = instanceOffset + gl_InstanceID * 4;
+    world = model * mat4(
+        texelFetch(instanceData, instanceBase + 0),
+        texelFetch(instanceData, instanceBase + 1),
+        texelFetch(instanceData, instanceBase + 2),
+        texelFetch(instanceData, instanceBase + 3)) * drawTransform;
+#endif
+
+    gl_Position = projection * view * world * aPos;
+    fragPos = vec3(world * aPos).xyz;
+
+#ifdef HAS_NORMALS
+    normal = mat3(world) * aNormal;
+#else
+    normal = vec3(0.0, 0.0, 1.0);
+#endif
+    tangent = vec4(mat3(world) * aTangent.xyz, aTangent.w);
+    texCoord = aTexCoord.xy;
+}
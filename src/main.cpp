@@ -4,43 +4,59 @@
 #include <memory>
 
 #include "App.hpp"
+#include "HotReload.hpp"
+#include "GoldenImages.hpp"
+#include "FrameUniforms.hpp"
+#include "Options.hpp"
 #include "Parser.hpp"
 #include "Shader.hpp"
 #include "Mesh.hpp"
 #include "Transform.hpp"
 
 int main(int argc, char** argv) {
-    if (argc != 2 && argc != 3) {
-        std::cerr << "Usage: " << argv[0] << " <obj file> [<texture file>]" << std::endl;
+    std::unique_ptr<Options> options;
+    std::unique_ptr<Parser> parser;
+    std::unique_ptr<Shader> shader;
+
+    try {
+        options = std::make_unique<Options>(argc, argv);
+    } catch (std::exception const &e) {
+        std::cerr << e.what() << std::endl;
+        std::cerr << Options::usage(argv[0]) << std::endl;
         return -1;
     }
 
-    std::unique_ptr<Parser> parser;
-    std::unique_ptr<Shader> shader;
+    std::vector<std::string> goldenAssets;
+    if (!options->goldenDirectory.empty()) {
+        goldenAssets = GoldenImages::listAssets(options->objPath);
+        if (goldenAssets.empty()) {
+            std::cerr << "No obj file in: " << options->objPath << std::endl;
+            return 1;
+        }
+        options->objPath = goldenAssets.front();
+    }
 
     try {
-        parser = std::make_unique<Parser>(argv[1], argc == 3 ? argv[2] : "assets/textures/wood.bmp");
+        parser = std::make_unique<Parser>(options->objPath, options->texturePath);
         std::cout << "Parsing done successfully" << std::endl;
         // std::cout << *parser << std::endl;
     } catch (std::exception const &e) {
-        std::cerr << "Failed to parse file: " << argv[1] << std::endl;
+        std::cerr << "Failed to parse file: " << options->objPath << std::endl;
         std::cerr << e.what() << std::endl;
         return 1;
     }
 
     auto objects = parser->getObjects();
     if (!objects.size()) {
-        std::cerr << "No object found in file: " << argv[1] << std::endl;
+        std::cerr << "No object found in file: " << options->objPath << std::endl;
         return 1;
     }
-    App app(objects);
+    App app(objects, parser->getTexture(), *options);
 
     try {
         shader = std::make_unique<Shader>(
             "shaders/vertex_shader.glsl", "shaders/fragment_shader.glsl",
-            app.hasNormals, 
-            &app.textureState,
-            parser->getTexture());
+            app.shaderFeatures());
         std::cout << "Shader compilation done successfully" << std::endl;
     } catch (std::exception const &e) {
         std::cerr << "Failed to compile shaders" << std::endl;
@@ -48,21 +64,31 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    app.run([&]() {
+    FrameUniforms frameUniforms;
+    HotReload hotReload(options->objPath, options->texturePath, app, parser, *shader, options->watch);
+
+    auto render = [&]() {
+        shader->select(app.shaderFeatures());
         shader->use();
+        frameUniforms.update(*app._transform, app.renderTextureState);
 
-        if (app.isInTransition) {
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, shader->_textureId);
-            app.updateTextureTransition(shader->getId());
-        }
-        shader->setMat4("model", app._transform->modelMat);
-        shader->setMat4("view", app._transform->viewMat);
-        shader->setMat4("projection", app._transform->projectionMat);
+        app.drawMesh(*shader);
+        frameUniforms.submitted();
+    };
 
-        app._mesh->draw();
+    if (!goldenAssets.empty()) {
+        try {
+            GoldenImages golden(app, render, *options);
+            return golden.run(goldenAssets) ? 0 : 1;
+        } catch (std::exception const &e) {
+            std::cerr << "Golden image check failed: " << e.what() << std::endl;
+            return 1;
+        }
+    }
 
-    });
+    app.run([&]() {
+        return hotReload.poll();
+    }, render);
 
     return 0;
-}
\ No newline at end of file
+}